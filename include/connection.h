@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+
+struct ssl_st;
+
+// A client connection: plain TCP, or TLS on the same socket.
+// Does not own the socket; the server closes it after the connection is destroyed.
+class Connection {
+public:
+    explicit Connection(int fd, ssl_st* ssl = nullptr);
+    ~Connection();
+    
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+    
+    // Read up to length bytes; 0 on orderly close, < 0 on error or timeout
+    ssize_t read(char* buffer, size_t length);
+    
+    // Write everything or fail
+    bool write_all(const char* data, size_t length);
+    
+    // Send length bytes of a file starting at offset: sendfile() for plain TCP, SSL_sendfile()
+    // when kernel TLS is active, otherwise read-and-write through TLS
+    bool send_file(int file_fd, size_t length, off_t offset = 0);
+    
+    // Whether decrypted data is already buffered, so read() won't block even if the
+    // socket itself has nothing to poll for
+    bool has_buffered_data() const;
+    
+    int get_fd() const { return fd_; }
+    bool is_tls() const { return ssl_ != nullptr; }
+    bool is_ktls() const;
+    
+    // Protocol negotiated with ALPN ("http/1.1", ...), empty if none
+    std::string get_alpn_protocol() const;
+
+private:
+    int fd_;
+    ssl_st* ssl_;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// HPACK header compression for HTTP/2 (RFC 7541)
+using HeaderField = std::pair<std::string, std::string>;
+
+// Static table followed by a dynamic table. Newest dynamic entries come first and the
+// oldest are evicted once the size (name + value + 32 per entry) exceeds the limit.
+class HpackTable {
+public:
+    static constexpr size_t kStaticTableSize = 61;
+    static constexpr size_t kDefaultMaxSize = 4096;
+    
+    explicit HpackTable(size_t max_size = kDefaultMaxSize);
+    
+    void set_max_size(size_t max_size);
+    size_t get_max_size() const { return max_size_; }
+    
+    void add(const std::string& name, const std::string& value);
+    
+    // Entry at a 1-based index spanning both tables; nullptr if out of range
+    const HeaderField* get(size_t index) const;
+    
+    // Index of an entry matching name and value, else of one matching the name only
+    // (name_only set), else 0
+    size_t find(const std::string& name, const std::string& value, bool& name_only) const;
+
+private:
+    void evict(size_t max_size);
+    
+    std::deque<HeaderField> entries_;
+    size_t size_;
+    size_t max_size_;
+};
+
+class HpackDecoder {
+public:
+    HpackDecoder();
+    
+    // Decode a complete header block into headers (appended). False on a compression
+    // error, after which the decoder is unusable and the connection must be closed.
+    // Fields beyond the header list limit are decoded but dropped (see is_truncated()).
+    bool decode(const uint8_t* data, size_t length, std::vector<HeaderField>& headers);
+    
+    // Whether the last block exceeded the header list limit
+    bool is_truncated() const { return truncated_; }
+    
+    // Largest table size the peer may switch to (our SETTINGS_HEADER_TABLE_SIZE)
+    void set_max_table_size(size_t max_size) { max_table_size_ = max_size; }
+    
+    // Limit on a decoded header list (name + value + 32 per field)
+    void set_max_header_list_size(size_t max_size) { max_header_list_size_ = max_size; }
+
+private:
+    HpackTable table_;
+    size_t max_table_size_;
+    size_t max_header_list_size_;
+    bool truncated_;
+};
+
+class HpackEncoder {
+public:
+    HpackEncoder();
+    
+    // Append the header block for headers to out. Names must be lowercase.
+    void encode(const std::vector<HeaderField>& headers, std::string& out);
+    
+    // Table size allowed by the peer (its SETTINGS_HEADER_TABLE_SIZE); we never use more
+    // than the default, and a change is signalled at the start of the next block
+    void set_max_table_size(size_t max_size);
+
+private:
+    HpackTable table_;
+    size_t pending_min_size_;   // Smallest size since the last block, if a change is pending
+    bool size_update_pending_;
+};
+
+// Huffman coding with the static HPACK code (Appendix B)
+class HpackHuffman {
+public:
+    // Append the decoded string to out; false on invalid padding or an EOS symbol
+    static bool decode(const uint8_t* data, size_t length, std::string& out);
+    
+    static void encode(const std::string& text, std::string& out);
+    static size_t encoded_length(const std::string& text);
+};
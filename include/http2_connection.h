@@ -0,0 +1,181 @@
+#pragma once
+
+#include "connection.h"
+#include "hpack.h"
+#include "http_request.h"
+#include "http_response.h"
+#include "multipart_parser.h"
+#include "route_handler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Server side of one HTTP/2 connection (RFC 9113). The connection thread owns the socket:
+// it parses frames, keeps the HPACK and flow-control state and writes every frame. Each
+// request runs on its own thread, so a slow handler doesn't hold up the other streams.
+class Http2Connection {
+public:
+    // Client connection preface; an HTTP/1.1 parser sees its first 18 bytes as a request head
+    static constexpr char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    static constexpr size_t kPrefaceLength = sizeof(kPreface) - 1;
+    static constexpr size_t kPrefaceHeadLength = 18;
+    
+    Http2Connection(Connection& connection, RouteHandler& route_handler,
+                    const std::atomic<bool>& running, size_t max_body_size);
+    ~Http2Connection();
+    
+    Http2Connection(const Http2Connection&) = delete;
+    Http2Connection& operator=(const Http2Connection&) = delete;
+    
+    // h2c upgrade: take over an HTTP/1.1 request (body already read) as stream 1, using
+    // the client's HTTP2-Settings. False if those are malformed. Call before serve(),
+    // once "101 Switching Protocols" is on its way.
+    bool upgrade(const HTTPRequest& request);
+    
+    // Serve until the connection closes. received holds bytes already read from the
+    // socket, starting with the client connection preface (if it has arrived yet).
+    void serve(const std::string& received);
+    
+    // Whether an HTTP/1.1 request asks to switch to h2c
+    static bool is_upgrade_request(const HTTPRequest& request);
+
+private:
+    enum class FrameType : uint8_t {
+        DATA = 0x0,
+        HEADERS = 0x1,
+        PRIORITY = 0x2,
+        RST_STREAM = 0x3,
+        SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5,
+        PING = 0x6,
+        GOAWAY = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION = 0x9
+    };
+    
+    enum class ErrorCode : uint32_t {
+        NO_ERROR = 0x0,
+        PROTOCOL_ERROR = 0x1,
+        INTERNAL_ERROR = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5,
+        FRAME_SIZE_ERROR = 0x6,
+        REFUSED_STREAM = 0x7,
+        COMPRESSION_ERROR = 0x9,
+        ENHANCE_YOUR_CALM = 0xb
+    };
+    
+    struct Stream {
+        HTTPRequest request;
+        std::string body;
+        bool head_request = false;
+        bool request_complete = false;   // END_STREAM received
+        bool discard_body = false;       // Answered early (e.g. 413); the rest is dropped
+        
+        // Streaming upload; the parser refers to the handler, so it is declared after it
+        std::unique_ptr<MultipartHandler> multipart_handler;
+        std::unique_ptr<MultipartParser> multipart_parser;
+        bool multipart_ok = true;
+        
+        int64_t send_window = 0;
+        int64_t recv_window = 0;
+        
+        // Response being sent: HEADERS are written at once, the body as flow control allows
+        bool responding = false;
+        HTTPResponse response;
+        std::shared_ptr<const std::string> serialized;
+        const char* data = nullptr;
+        size_t remaining = 0;
+        off_t file_offset = 0;
+    };
+    
+    // Input
+    bool read_input();
+    bool wait_for_input();
+    void process_input();
+    void handle_frame(FrameType type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length);
+    void handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length);
+    void handle_continuation(uint8_t flags, const uint8_t* payload, size_t length);
+    void handle_header_block();
+    void handle_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length);
+    void handle_settings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length);
+    void handle_window_update(uint32_t stream_id, const uint8_t* payload, size_t length);
+    bool apply_settings(const uint8_t* payload, size_t length);
+    bool is_idle(uint32_t stream_id) const { return stream_id > last_stream_id_ && !goaway_sent_; }
+    
+    // Requests and responses
+    size_t active_stream_count() const;
+    void open_stream(uint32_t stream_id, const std::vector<HeaderField>& headers, bool end_stream);
+    void end_request(uint32_t stream_id, Stream& stream);
+    void dispatch(uint32_t stream_id, HTTPRequest request);
+    void collect_responses();
+    void start_response(uint32_t stream_id, const HTTPResponse& response);
+    void write_data();
+    
+    // Output, buffered until flush()
+    void write_frame_header(size_t length, FrameType type, uint8_t flags, uint32_t stream_id);
+    void write_settings();
+    void write_window_update(uint32_t stream_id, uint32_t increment);
+    void write_rst_stream(uint32_t stream_id, ErrorCode code);
+    void write_goaway(ErrorCode code);
+    void stream_error(uint32_t stream_id, ErrorCode code);
+    void connection_error(ErrorCode code);
+    bool flush();
+    
+    // Our settings
+    static constexpr size_t kMaxFrameSize = 16384;
+    static constexpr size_t kMaxConcurrentStreams = 100;
+    static constexpr size_t kMaxHeaderListSize = 64 * 1024;
+    static constexpr int64_t kStreamWindow = 1024 * 1024;
+    static constexpr int64_t kConnectionWindow = 16 * 1024 * 1024;
+    
+    static constexpr int64_t kDefaultWindow = 65535;
+    static constexpr int64_t kMaxWindow = 0x7fffffff;
+    static constexpr size_t kFlushThreshold = 64 * 1024;
+    static constexpr std::chrono::seconds kIdleTimeout{30};
+    
+    Connection& connection_;
+    RouteHandler& route_handler_;
+    const std::atomic<bool>& running_;
+    size_t max_body_size_;
+    
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    
+    std::string input_;
+    size_t input_offset_;
+    std::string output_;
+    
+    std::map<uint32_t, Stream> streams_;
+    uint32_t last_stream_id_;
+    
+    // Header block being assembled from HEADERS and CONTINUATION frames
+    uint32_t header_stream_id_;
+    bool header_end_stream_;
+    std::string header_block_;
+    
+    // Connection-level flow control and peer settings
+    int64_t send_window_;
+    int64_t recv_window_;
+    int64_t peer_initial_window_;
+    size_t peer_max_frame_size_;
+    
+    bool goaway_sent_;
+    bool peer_goaway_;
+    bool closing_;   // Connection error: stop once the GOAWAY is out
+    bool broken_;    // Socket closed or failed
+    std::chrono::steady_clock::time_point last_activity_;
+    
+    // Handler threads, and the responses they hand back to the connection thread
+    std::map<uint32_t, std::thread> workers_;
+    std::mutex completed_mutex_;
+    std::vector<std::pair<uint32_t, HTTPResponse>> completed_;
+    int event_fd_;
+};
@@ -1,11 +1,18 @@
 #pragma once
 
+#include "url_encoded.h"
 #include <string>
 #include <map>
 #include <vector>
 
 class HTTPRequest {
 public:
+    // Header names compare case-insensitively ("content-type" finds "Content-Type")
+    struct HeaderNameLess {
+        bool operator()(const std::string& a, const std::string& b) const;
+    };
+    using Headers = std::map<std::string, std::string, HeaderNameLess>;
+    
     enum class Method {
         GET,
         POST,
@@ -18,32 +25,54 @@ public:
 
     HTTPRequest();
     
-    // Parse raw HTTP request data
+    // Parse raw HTTP request data (head, optionally followed by the body)
     bool parse(const std::string& raw_request);
     
+    // Body received separately from the head
+    void set_body(std::string body) { body_ = std::move(body); }
+    
+    // Build a request field by field (e.g. from HTTP/2 pseudo-headers)
+    void set_method(const std::string& method) { method_ = parse_method(method); }
+    void set_target(const std::string& target);
+    void set_version(const std::string& version) { version_ = version; }
+    
+    // Add a header; repeated headers are combined into one comma-separated value
+    // ("; "-separated for Cookie)
+    void add_header(const std::string& name, const std::string& value);
+    
     // Getters
     Method get_method() const { return method_; }
     const std::string& get_path() const { return path_; }
     const std::string& get_version() const { return version_; }
-    const std::map<std::string, std::string>& get_headers() const { return headers_; }
+    const Headers& get_headers() const { return headers_; }
     const std::string& get_body() const { return body_; }
-    const std::map<std::string, std::string>& get_query_params() const { return query_params_; }
+    const std::string& get_query_string() const { return query_string_; }
+    
+    // Lazily decoded query string and application/x-www-form-urlencoded body.
+    // Views returned by these objects must not outlive the request.
+    UrlEncodedParams query() const { return UrlEncodedParams(query_string_); }
+    UrlEncodedParams form() const;
     
     // Utility methods
     std::string get_header(const std::string& name) const;
     bool has_header(const std::string& name) const;
     std::string get_query_param(const std::string& name) const;
+    
+    // Content-Length as a number (0 if absent); false if it isn't a plain decimal
+    bool get_content_length(size_t& length) const;
+    std::multimap<std::string, std::string> get_query_params() const;
+    
+    static std::string method_to_string(Method method);
 
 private:
     void parse_request_line(const std::string& line);
     void parse_headers(const std::vector<std::string>& header_lines);
-    void parse_query_string(const std::string& query_string);
     Method parse_method(const std::string& method_str);
     
     Method method_;
     std::string path_;
     std::string version_;
-    std::map<std::string, std::string> headers_;
+    Headers headers_;
     std::string body_;
-    std::map<std::string, std::string> query_params_;
+    std::string query_string_;
 }; 
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "http_request.h"
 #include <string>
 #include <map>
+#include <memory>
 
 class HTTPResponse {
 public:
@@ -12,21 +14,51 @@ public:
         BAD_REQUEST = 400,
         NOT_FOUND = 404,
         METHOD_NOT_ALLOWED = 405,
+        CONFLICT = 409,
+        LENGTH_REQUIRED = 411,
+        PAYLOAD_TOO_LARGE = 413,
         INTERNAL_SERVER_ERROR = 500,
-        NOT_IMPLEMENTED = 501
+        NOT_IMPLEMENTED = 501,
+        BAD_GATEWAY = 502,
+        SERVICE_UNAVAILABLE = 503
     };
 
     HTTPResponse();
     
     // Setters
     void set_status_code(StatusCode code) { status_code_ = code; }
+    void set_status_message(const std::string& message) { status_message_ = message; }
     void set_body(const std::string& body) { body_ = body; }
     void set_content_type(const std::string& content_type);
+    
+    // Set a header, replacing any field of that name (names are case-insensitive)
     void add_header(const std::string& name, const std::string& value);
     
+    // Add another field of that name, keeping the existing ones (e.g. Set-Cookie)
+    void append_header(const std::string& name, const std::string& value);
+    
+    // Serve an open file as the body, sent with sendfile(); takes ownership of fd
+    void set_file_body(int fd, size_t size);
+    
+    // Getters
+    StatusCode get_status_code() const { return status_code_; }
+    
+    // Body buffer for writers that build the body in place (e.g. JsonWriter)
+    std::string& get_body_buffer() { return body_; }
+    
+    bool has_file_body() const { return file_body_ != nullptr; }
+    int get_file_fd() const { return file_body_ ? file_body_->fd : -1; }
+    size_t get_file_size() const { return file_body_ ? file_body_->size : 0; }
+    
     // Generate HTTP response string
     std::string to_string() const;
     
+    // Status line and headers only, for bodies sent separately (file bodies)
+    std::string head_to_string() const;
+    
+    // Serialized response, shared without copying when it was built from a cached one
+    std::shared_ptr<const std::string> serialize() const;
+    
     // Utility methods
     void set_json_response(const std::string& json_data);
     void set_html_response(const std::string& html_data);
@@ -37,12 +69,27 @@ public:
     static HTTPResponse not_found(const std::string& message = "Not Found");
     static HTTPResponse bad_request(const std::string& message = "Bad Request");
     static HTTPResponse internal_error(const std::string& message = "Internal Server Error");
+    static HTTPResponse length_required(const std::string& message = "Length Required");
+    static HTTPResponse payload_too_large(const std::string& message = "Payload Too Large");
+    static HTTPResponse not_implemented(const std::string& message = "Not Implemented");
+    static HTTPResponse bad_gateway(const std::string& message = "Bad Gateway");
+    static HTTPResponse service_unavailable(const std::string& message = "Service Unavailable");
+    static HTTPResponse from_serialized(std::shared_ptr<const std::string> serialized);
 
 private:
+    struct FileBody {
+        int fd;
+        size_t size;
+        ~FileBody();
+    };
+    
     std::string status_code_to_string(StatusCode code) const;
     std::string get_status_message(StatusCode code) const;
     
     StatusCode status_code_;
+    std::string status_message_;   // Overrides the default reason phrase (e.g. from an upstream)
     std::string body_;
-    std::map<std::string, std::string> headers_;
+    std::multimap<std::string, std::string, HTTPRequest::HeaderNameLess> headers_;
+    std::shared_ptr<const std::string> serialized_;   // Set for responses served from the cache
+    std::shared_ptr<FileBody> file_body_;
 }; 
\ No newline at end of file
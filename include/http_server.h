@@ -1,5 +1,8 @@
 #pragma once
 
+#include "route_handler.h"
+#include "connection.h"
+#include "tls_context.h"
 #include <string>
 #include <thread>
 #include <vector>
@@ -7,42 +10,109 @@
 #include <memory>
 #include <functional>
 #include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
-class HTTPRequest;
-class HTTPResponse;
-class RouteHandler;
-
 class HTTPServer {
 public:
     HTTPServer(int port = 8080, int max_connections = 100);
     ~HTTPServer();
 
-    // Start the server
+    // Start the server (returns once the listener is accepting)
     bool start();
     
-    // Stop the server
+    // Stop accepting, drain in-flight requests and stop the server
     void stop();
     
+    // Time in-flight requests get to finish before their sockets are shut down
+    void set_shutdown_timeout(std::chrono::milliseconds timeout) { shutdown_timeout_ = timeout; }
+    
+    // Unix socket used to take over the listener from a running predecessor
+    // and to hand it on to a successor (zero-downtime restart)
+    void set_handoff_path(const std::string& path) { handoff_path_ = path; }
+    
+    // Serve HTTPS with this PEM certificate chain and key; false if they can't be loaded
+    bool set_tls(const std::string& cert_file, const std::string& key_file);
+    
+    // Largest request body buffered for a regular route (multipart uploads stream instead)
+    void set_max_body_size(size_t bytes) { max_body_size_ = bytes; }
+    
+    // Restrict the server's threads to these cores (empty: no restriction)
+    void set_cpus(const std::vector<int>& cpus) { cpus_ = cpus; }
+    
+    // Shared-nothing mode: one SO_REUSEPORT listener and pinned acceptor per core,
+    // with each connection served on the core that accepted it
+    void set_shard_per_core(bool enabled) { shard_per_core_ = enabled; }
+    
+    // Parse a CPU list such as "0-3,6"; empty on error
+    static std::vector<int> parse_cpu_list(const std::string& list);
+    
     // Check if server is running
     bool is_running() const { return running_; }
     
     // Get server port
     int get_port() const { return port_; }
+    
+    // Routes served by this server; register before start()
+    RouteHandler& get_route_handler() { return *route_handler_; }
 
 private:
-    void accept_connections();
-    void handle_client(int client_socket);
+    int open_listener(bool reuse_port);
+    void close_listeners();
+    void accept_connections(std::vector<int> listeners, std::vector<int> cpus);
+    static void pin_current_thread(const std::vector<int>& cpus);
+    void handle_client(int client_socket, uint64_t accepted_at);
+    void serve_request(Connection& connection);
+    void serve_http2(Connection& connection, const std::string& received);
+    HTTPResponse receive_multipart(Connection& connection, const HTTPRequest& request,
+                                   const RouteHandler::MultipartFactory& factory,
+                                   const std::string& initial_body, size_t content_length);
+    void send_continue(Connection& connection, const HTTPRequest& request,
+                       const std::string& body, size_t content_length);
+    void send_response(Connection& connection, const HTTPResponse& response);
     void worker_thread();
+    void drain_connections();
+    
+    // Listener handoff over SCM_RIGHTS. The successor confirms with one byte once it
+    // is serving; until then (or if it never does) the predecessor keeps serving.
+    static constexpr size_t kMaxHandoffListeners = 256;
+    static constexpr std::chrono::seconds kHandoffAckTimeout{10};
+    std::vector<int> receive_listeners();
+    bool open_handoff_socket();
+    void handoff_loop();
+    bool wait_for_handoff_ack(int successor);
     
     int port_;
     int max_connections_;
-    int server_socket_;
+    std::vector<int> listeners_;
+    int handoff_socket_;
+    int predecessor_socket_;   // Connection to the predecessor until startup is confirmed
+    bool started_;
+    bool shard_per_core_;
+    std::vector<int> cpus_;
     std::atomic<bool> running_;
+    std::vector<std::thread> acceptor_threads_;
+    std::thread handoff_thread_;
     std::vector<std::thread> worker_threads_;
     std::unique_ptr<RouteHandler> route_handler_;
+    std::unique_ptr<TlsContext> tls_context_;
+    
+    static constexpr size_t kMaxHeaderSize = 64 * 1024;
+    size_t max_body_size_;
+    
+    // Shutdown / handoff configuration
+    std::chrono::milliseconds shutdown_timeout_;
+    std::string handoff_path_;
+    
+    // In-flight client connections, drained on stop()
+    std::mutex clients_mutex_;
+    std::condition_variable clients_cv_;
+    std::set<int> active_clients_;
     
     // Socket address structures
     struct sockaddr_in server_addr_;
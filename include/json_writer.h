@@ -0,0 +1,53 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Streaming JSON writer that appends straight into a caller-owned buffer
+// (typically the response body). Commas are inserted automatically.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out);
+    
+    // Structure
+    JsonWriter& begin_object();
+    JsonWriter& end_object();
+    JsonWriter& begin_array();
+    JsonWriter& end_array();
+    JsonWriter& key(std::string_view name);
+    
+    // Values
+    JsonWriter& value(std::string_view text);
+    JsonWriter& value(const char* text) { return value(std::string_view(text)); }
+    JsonWriter& value(const std::string& text) { return value(std::string_view(text)); }
+    JsonWriter& value(bool flag);
+    JsonWriter& value(double number);
+    JsonWriter& null_value();
+    
+    template <typename T>
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, JsonWriter&> value(T number) {
+        before_value();
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), number);
+        out_.append(digits, result.ptr - digits);
+        return *this;
+    }
+    
+    // Append text as a quoted, escaped JSON string
+    static void write_string(std::string& out, std::string_view text);
+
+private:
+    void before_value();
+    void open(char bracket);
+    void close(char bracket);
+    
+    static constexpr int kMaxDepth = 64;
+    
+    std::string& out_;
+    int depth_;
+    uint64_t has_items_;   // Bit per nesting level: a value was already written there
+    bool after_key_;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "http_request.h"
+#include "http_response.h"
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Receives the parts of one multipart/form-data body as it streams in.
+// Returning false from a callback aborts the upload.
+class MultipartHandler {
+public:
+    using PartHeaders = std::map<std::string, std::string>;
+    
+    virtual ~MultipartHandler() = default;
+    
+    virtual bool on_part_begin(const PartHeaders& headers) = 0;
+    virtual bool on_part_data(const char* data, size_t length) = 0;
+    virtual bool on_part_end() = 0;
+    
+    // Called once the body has been consumed; complete is false if it was malformed,
+    // truncated or aborted
+    virtual HTTPResponse finish(bool complete) = 0;
+    
+    // Parameter of a header value, e.g. header_param("form-data; name=\"file\"", "name") -> "file"
+    static std::string header_param(const std::string& value, const std::string& param);
+};
+
+// Incremental multipart/form-data parser. Memory use is bounded by the largest
+// fed chunk plus the boundary length, regardless of body size.
+class MultipartParser {
+public:
+    MultipartParser(const std::string& boundary, MultipartHandler& handler);
+    
+    // Feed the next chunk of the body; false once the body is malformed or aborted
+    bool feed(const char* data, size_t length);
+    
+    // Whether the closing boundary has been seen
+    bool is_complete() const { return state_ == State::DONE; }
+    
+    // Boundary parameter of a multipart/form-data Content-Type, or empty
+    static std::string boundary_from_content_type(const std::string& content_type);
+
+private:
+    enum class State {
+        PREAMBLE,
+        AFTER_BOUNDARY,
+        HEADERS,
+        BODY,
+        DONE,
+        FAILED
+    };
+    
+    // Boyer-Moore-Horspool search for the delimiter in data[0, length)
+    size_t find_delimiter(const char* data, size_t length) const;
+    bool parse_part_headers(const std::string& block);
+    
+    static constexpr size_t kMaxHeaderBlock = 16 * 1024;
+    
+    std::string delimiter_;     // "\r\n--" + boundary
+    size_t skip_[256];
+    MultipartHandler& handler_;
+    State state_;
+    std::string buffer_;        // Unconsumed input: at most one chunk plus a partial delimiter
+};
+
+// Saves file parts straight to a directory and keeps small text fields in memory.
+// Files are written under temporary names and only appear under their own names once
+// the whole body has been received; existing files are never replaced.
+class MultipartFileSaver : public MultipartHandler {
+public:
+    explicit MultipartFileSaver(const std::string& directory);
+    ~MultipartFileSaver() override;
+    
+    bool on_part_begin(const PartHeaders& headers) override;
+    bool on_part_data(const char* data, size_t length) override;
+    bool on_part_end() override;
+    HTTPResponse finish(bool complete) override;
+
+private:
+    struct SavedFile {
+        std::string field;
+        std::string filename;
+        std::string temp_path;     // Empty once moved to its final name
+        size_t size;
+    };
+    
+    // Remove every file of this upload that is still under its temporary name
+    void discard_temp_files();
+    
+    static constexpr size_t kMaxParts = 256;
+    static constexpr size_t kMaxFieldSize = 64 * 1024;
+    static constexpr size_t kMaxFieldsSize = 1024 * 1024;   // All text fields together
+    
+    std::string directory_;
+    std::string field_;
+    std::string field_value_;
+    std::ofstream file_;
+    bool in_file_;
+    size_t parts_;
+    size_t fields_size_;
+    bool conflict_;            // A file of the same name already exists
+    std::vector<SavedFile> files_;
+    std::map<std::string, std::string> fields_;
+};
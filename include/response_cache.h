@@ -0,0 +1,78 @@
+#pragma once
+
+#include "http_request.h"
+#include "http_response.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sharded cache of fully serialized responses for opt-in routes
+class ResponseCache {
+public:
+    using Generator = std::function<HTTPResponse(const HTTPRequest&)>;
+    
+    struct Policy {
+        std::chrono::milliseconds ttl{1000};
+        std::chrono::milliseconds stale_while_revalidate{0};   // Serve stale while one refresh runs
+        std::vector<std::string> query_params;                 // Empty: key on the whole query string
+        std::vector<std::string> vary_headers;
+    };
+    
+    explicit ResponseCache(size_t max_bytes = 64 * 1024 * 1024, size_t num_shards = 16);
+    ~ResponseCache();
+    
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+    
+    // Return a cached response for the request, generating it on a miss.
+    // Concurrent misses for the same key share a single generate() call.
+    HTTPResponse get_or_generate(const HTTPRequest& request, const Policy& policy, const Generator& generate);
+    
+    static std::string make_key(const HTTPRequest& request, const Policy& policy);
+    
+    void clear();
+    size_t size_bytes() const;
+
+private:
+    using Serialized = std::shared_ptr<const std::string>;
+    using Clock = std::chrono::steady_clock;
+    
+    struct Entry {
+        Serialized response;
+        Clock::time_point fresh_until;
+        Clock::time_point stale_until;
+        size_t bytes;
+        std::list<std::string>::iterator lru_position;
+    };
+    
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::list<std::string> lru;                       // Most recently used at the front
+        std::unordered_map<std::string, std::shared_future<Serialized>> pending;
+        size_t bytes = 0;
+    };
+    
+    Shard& shard_for(const std::string& key);
+    Serialized generate_and_store(Shard& shard, const std::string& key, const Policy& policy,
+                                  const HTTPRequest& request, const Generator& generate,
+                                  std::promise<Serialized>& promise, HTTPResponse* response);
+    void store(Shard& shard, const std::string& key, const Policy& policy, const Serialized& response);
+    void revalidate(Shard& shard, const std::string& key, const Policy& policy,
+                    const HTTPRequest& request, const Generator& generate);
+    
+    size_t shard_budget_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    
+    // Background revalidations, waited for on destruction
+    std::mutex revalidate_mutex_;
+    std::condition_variable revalidate_cv_;
+    int revalidations_;
+};
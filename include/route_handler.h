@@ -2,20 +2,42 @@
 
 #include "http_request.h"
 #include "http_response.h"
+#include "response_cache.h"
+#include "multipart_parser.h"
+#include <atomic>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
+class UpstreamPool;
+
 class RouteHandler {
 public:
     using RouteCallback = std::function<HTTPResponse(const HTTPRequest&)>;
+    using MultipartFactory = std::function<std::unique_ptr<MultipartHandler>(const HTTPRequest&)>;
     
     RouteHandler();
     
     // Register routes
     void register_route(const std::string& method, const std::string& path, RouteCallback callback);
     
+    // Register a route whose successful responses are cached per the policy
+    void register_cached_route(const std::string& method, const std::string& path, RouteCallback callback,
+                               const ResponseCache::Policy& policy);
+    
+    // Register a POST route whose multipart/form-data body is streamed part by part
+    // into a handler created per request
+    void register_multipart_route(const std::string& path, MultipartFactory factory);
+    
+    // Streaming upload route for the request, if any (checked before the body is read)
+    const MultipartFactory* find_multipart_route(const HTTPRequest& request) const;
+    
+    // Forward every method on a path (e.g. "/api/*") to an upstream pool; proxy routes
+    // take precedence over all other routes
+    void register_proxy_route(const std::string& path, std::shared_ptr<UpstreamPool> upstreams);
+    
     // Handle incoming request
     HTTPResponse handle_request(const HTTPRequest& request);
     
@@ -29,9 +51,21 @@ private:
         RouteCallback callback;
     };
     
+    struct MultipartRoute {
+        std::string path;
+        MultipartFactory factory;
+    };
+    
     std::vector<Route> routes_;
+    size_t proxy_route_count_;   // Proxy routes, kept at the front of routes_
+    std::atomic<uint64_t> cached_echo_generations_;
+    std::vector<MultipartRoute> multipart_routes_;
+    
+    // Declared after routes_ so it is destroyed first, while revalidation callbacks are still valid
+    ResponseCache response_cache_;
     
     // Helper methods
+    const Route* find_route(const HTTPRequest& request) const;
     bool path_matches(const std::string& route_path, const std::string& request_path) const;
     std::vector<std::string> split_path(const std::string& path) const;
     
@@ -39,5 +73,6 @@ private:
     HTTPResponse handle_root(const HTTPRequest& request);
     HTTPResponse handle_health(const HTTPRequest& request);
     HTTPResponse handle_echo(const HTTPRequest& request);
+    HTTPResponse handle_cached_echo(const HTTPRequest& request);
     HTTPResponse handle_static_file(const HTTPRequest& request);
 }; 
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "connection.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ssl_ctx_st;
+
+// Server-side TLS configuration shared by all connections: certificate, session
+// resumption (tickets and a server-side session cache), ALPN and kernel TLS offload
+class TlsContext {
+public:
+    TlsContext();
+    ~TlsContext();
+    
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+    
+    // Load a PEM certificate chain and private key
+    bool load(const std::string& cert_file, const std::string& key_file);
+    
+    // ALPN protocols in order of preference (default: http/1.1; the server adds h2)
+    void set_alpn_protocols(const std::vector<std::string>& protocols) { alpn_protocols_ = protocols; }
+    
+    // Run the server handshake on an accepted socket; nullptr on failure
+    std::unique_ptr<Connection> accept(int fd);
+    
+    // Whether this build has TLS support
+    static bool is_supported();
+
+private:
+    static int select_alpn(ssl_st* ssl, const unsigned char** out, unsigned char* out_length,
+                           const unsigned char* in, unsigned int in_length, void* arg);
+    
+    ssl_ctx_st* ctx_;
+    std::vector<std::string> alpn_protocols_;
+};
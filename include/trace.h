@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Hot-path tracing: sampled requests record a span per phase (accept, TLS handshake, recv,
+// parse, route lookup, callback, send) into per-thread ring buffers, exported as Chrome
+// trace JSON (chrome://tracing, ui.perfetto.dev). Build with HTTP_SERVER_WITH_TRACING to
+// enable; otherwise the TRACE_* macros below compile to nothing.
+class Tracer {
+public:
+    enum class Phase : uint8_t {
+        CONNECTION,   // Whole connection thread, from the end of accept
+        ACCEPT,       // accept() until the connection thread is running
+        HANDSHAKE,
+        RECV,
+        PARSE,
+        ROUTE,
+        CALLBACK,
+        UPLOAD,       // Streamed multipart body, parser and handler included
+        SEND,
+        STREAM        // HTTP/2 stream handled on its own thread
+    };
+    
+    // Whether tracing was compiled in
+    static bool is_supported();
+    
+    // Trace one request in every n (0, the default, turns tracing off)
+    static void set_sample_rate(uint32_t n);
+    static uint32_t get_sample_rate();
+    
+    // Decide whether the request now starting on this thread is traced
+    static void begin_request();
+    static bool is_sampled() { return sampled_; }
+    
+    // Timestamp in ticks: the TSC where available, else steady_clock nanoseconds
+    static uint64_t now();
+    
+    static void record(Phase phase, uint64_t start, uint64_t end);
+    
+    // Everything still in the ring buffers, as Chrome trace JSON
+    static std::string to_json();
+    static bool write_json(const std::string& path);
+
+private:
+    static inline thread_local bool sampled_ = false;
+    static inline thread_local uint64_t request_id_ = 0;
+};
+
+// Records the enclosing scope as a span if the current request is sampled
+class TraceScope {
+public:
+    explicit TraceScope(Tracer::Phase phase)
+        : phase_(phase), start_(Tracer::is_sampled() ? Tracer::now() : 0) {}
+    ~TraceScope() {
+        if (start_) Tracer::record(phase_, start_, Tracer::now());
+    }
+    
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    Tracer::Phase phase_;
+    uint64_t start_;
+};
+
+#ifdef HTTP_SERVER_WITH_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_BEGIN_REQUEST() Tracer::begin_request()
+#define TRACE_SCOPE(phase) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(Tracer::Phase::phase)
+#define TRACE_NOW() Tracer::now()
+#define TRACE_SINCE(phase, start) \
+    do { if (Tracer::is_sampled()) Tracer::record(Tracer::Phase::phase, (start), Tracer::now()); } while (0)
+#else
+#define TRACE_BEGIN_REQUEST() ((void)0)
+#define TRACE_SCOPE(phase) ((void)0)
+#define TRACE_NOW() uint64_t(0)
+#define TRACE_SINCE(phase, start) ((void)(start))
+#endif
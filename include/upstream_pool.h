@@ -0,0 +1,81 @@
+#pragma once
+
+#include "http_request.h"
+#include "http_response.h"
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pool of persistent connections to a set of HTTP/1.1 backends, used by proxy routes.
+// Requests and responses are buffered whole, not streamed: responses are capped by
+// set_max_response_size() and only sent on once complete.
+class UpstreamPool {
+public:
+    enum class Balancing {
+        ROUND_ROBIN,
+        LEAST_CONNECTIONS
+    };
+
+    explicit UpstreamPool(Balancing balancing = Balancing::ROUND_ROBIN);
+    ~UpstreamPool();
+    
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+    
+    // Configuration
+    void add_upstream(const std::string& host, int port);
+    void set_max_idle_connections(size_t max_idle) { max_idle_ = max_idle; }
+    
+    // Largest response buffered (16 MiB by default); larger ones become a 502
+    void set_max_response_size(size_t bytes) { max_response_size_ = bytes; }
+    void set_max_fails(int max_fails) { max_fails_ = max_fails; }
+    void set_fail_timeout(std::chrono::seconds fail_timeout) { fail_timeout_ = fail_timeout; }
+    
+    // Add every upstream in a "host:port[,host:port...]" list
+    bool add_upstreams(const std::string& list);
+    
+    // Forward a request to a healthy upstream and return its response
+    HTTPResponse forward(const HTTPRequest& request);
+
+private:
+    struct Upstream {
+        std::string host;
+        int port;
+        std::vector<int> idle;     // Persistent connections ready for reuse
+        int active;                // Requests currently in flight
+        int fails;                 // Consecutive failures (passive health check)
+        std::chrono::steady_clock::time_point down_until;
+    };
+    
+    enum class Result {
+        OK,
+        STALE_CONNECTION,   // Nothing could be sent: safe to retry anywhere
+        NO_RESPONSE,        // Request sent, but the connection closed before any response byte
+        TOO_LARGE,          // Response exceeds max_response_size_
+        FAILED
+    };
+    
+    Upstream* select_upstream(const std::vector<Upstream*>& tried);
+    int acquire_connection(Upstream& upstream, bool& reused);
+    void release_connection(Upstream& upstream, int fd, bool reusable);
+    void record_result(Upstream& upstream, bool success);
+    Result exchange(int fd, const std::string& request_data, bool head_request,
+                    HTTPResponse& response, bool& reusable);
+    
+    std::string serialize_request(const HTTPRequest& request, const Upstream& upstream) const;
+    static int connect_to(const std::string& host, int port);
+    
+    static constexpr size_t kMaxHeaderSize = 64 * 1024;
+    
+    Balancing balancing_;
+    size_t max_idle_;
+    size_t max_response_size_;
+    int max_fails_;
+    std::chrono::seconds fail_timeout_;
+    size_t next_;
+    
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lazy view over application/x-www-form-urlencoded text (a query string or form body).
+// Nothing is parsed up front: lookups scan the raw text, and only matching keys and
+// values are percent-decoded. Values without escapes are returned as views into the
+// raw text; decoded ones live in an arena owned by this object, so returned views
+// stay valid for its lifetime (and that of the underlying text).
+class UrlEncodedParams {
+public:
+    UrlEncodedParams() = default;
+    explicit UrlEncodedParams(std::string_view raw) : raw_(raw) {}
+    
+    UrlEncodedParams(UrlEncodedParams&&) = default;
+    UrlEncodedParams& operator=(UrlEncodedParams&&) = default;
+    UrlEncodedParams(const UrlEncodedParams&) = delete;
+    UrlEncodedParams& operator=(const UrlEncodedParams&) = delete;
+    
+    // First value for a key; keys present without '=' have an empty value
+    std::optional<std::string_view> get(std::string_view name) const;
+    
+    // Every value for a repeated key, in order
+    std::vector<std::string_view> get_all(std::string_view name) const;
+    
+    bool has(std::string_view name) const { return get(name).has_value(); }
+    bool empty() const { return raw_.empty(); }
+    std::string_view raw() const { return raw_; }
+    
+    // Visit every (key, value) pair in order, decoded
+    template <typename Visitor>
+    void for_each(Visitor&& visit) const {
+        size_t pos = 0;
+        std::string_view key, value;
+        while (next_pair(pos, key, value)) {
+            visit(decode(key), decode(value));
+        }
+    }
+    
+    // Percent-decode, treating '+' as a space
+    static std::string decode_to_string(std::string_view encoded);
+
+private:
+    bool next_pair(size_t& pos, std::string_view& key, std::string_view& value) const;
+    std::string_view decode(std::string_view encoded) const;
+    static bool key_matches(std::string_view encoded_key, std::string_view name);
+    static size_t decode_into(char* out, std::string_view encoded);
+    char* allocate(size_t size) const;
+    
+    std::string_view raw_;
+    
+    // Bump arena for decoded strings; blocks never move once allocated
+    mutable std::vector<std::unique_ptr<char[]>> blocks_;
+    mutable size_t block_used_ = 0;
+    mutable size_t block_size_ = 0;
+};
@@ -0,0 +1,119 @@
+#include "connection.h"
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#ifdef HTTP_SERVER_WITH_TLS
+#include <openssl/ssl.h>
+#include <openssl/bio.h>
+#endif
+
+Connection::Connection(int fd, ssl_st* ssl)
+    : fd_(fd), ssl_(ssl) {
+}
+
+Connection::~Connection() {
+#ifdef HTTP_SERVER_WITH_TLS
+    if (ssl_) {
+        // Send close_notify without waiting for the peer's reply
+        SSL_shutdown(ssl_);
+        SSL_free(ssl_);
+    }
+#endif
+}
+
+ssize_t Connection::read(char* buffer, size_t length) {
+#ifdef HTTP_SERVER_WITH_TLS
+    if (ssl_) {
+        int n = SSL_read(ssl_, buffer, static_cast<int>(std::min<size_t>(length, INT32_MAX)));
+        if (n > 0) return n;
+        return SSL_get_error(ssl_, n) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+    }
+#endif
+    return recv(fd_, buffer, length, 0);
+}
+
+bool Connection::write_all(const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n;
+#ifdef HTTP_SERVER_WITH_TLS
+        if (ssl_) {
+            n = SSL_write(ssl_, data + sent, static_cast<int>(std::min<size_t>(length - sent, INT32_MAX)));
+        } else
+#endif
+        {
+            // MSG_NOSIGNAL keeps a peer reset during shutdown from raising SIGPIPE
+            n = send(fd_, data + sent, length - sent, MSG_NOSIGNAL);
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+bool Connection::send_file(int file_fd, size_t length, off_t offset) {
+    const off_t end = offset + length;
+    
+#ifdef HTTP_SERVER_WITH_TLS
+    if (ssl_ && is_ktls()) {
+        // Kernel TLS encrypts in the kernel, so the file still never enters user space
+        while (offset < end) {
+            ossl_ssize_t n = SSL_sendfile(ssl_, file_fd, offset, end - offset, 0);
+            if (n <= 0) return false;
+            offset += n;
+        }
+        return true;
+    }
+    
+    if (ssl_) {
+        char buffer[65536];
+        while (offset < end) {
+            ssize_t n = pread(file_fd, buffer, std::min<off_t>(sizeof(buffer), end - offset), offset);
+            if (n <= 0 || !write_all(buffer, n)) return false;
+            offset += n;
+        }
+        return true;
+    }
+#endif
+    
+    while (offset < end) {
+        ssize_t n = sendfile(fd_, file_fd, &offset, end - offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Connection::has_buffered_data() const {
+#ifdef HTTP_SERVER_WITH_TLS
+    return ssl_ && SSL_pending(ssl_) > 0;
+#else
+    return false;
+#endif
+}
+
+bool Connection::is_ktls() const {
+#ifdef HTTP_SERVER_WITH_TLS
+    return ssl_ && BIO_get_ktls_send(SSL_get_wbio(ssl_));
+#else
+    return false;
+#endif
+}
+
+std::string Connection::get_alpn_protocol() const {
+#ifdef HTTP_SERVER_WITH_TLS
+    if (ssl_) {
+        const unsigned char* protocol = nullptr;
+        unsigned int length = 0;
+        SSL_get0_alpn_selected(ssl_, &protocol, &length);
+        return std::string(reinterpret_cast<const char*>(protocol), length);
+    }
+#endif
+    return "";
+}
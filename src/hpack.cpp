@@ -0,0 +1,376 @@
+#include "hpack.h"
+#include <algorithm>
+
+namespace {
+
+const HeaderField kStaticTable[HpackTable::kStaticTableSize] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// Code length of each symbol (256 is EOS). The code is canonical: codes of equal length
+// are consecutive in symbol order, so the codes themselves follow from the lengths.
+const uint8_t kHuffmanLengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+constexpr int kMaxHuffmanLength = 30;
+constexpr uint16_t kEos = 256;
+
+struct HuffmanCode {
+    uint32_t codes[257];
+    
+    // For decoding: symbols in code order, and per length the first code and its position
+    uint16_t symbols[257];
+    uint32_t first_code[kMaxHuffmanLength + 1];
+    uint16_t count[kMaxHuffmanLength + 1];
+    uint16_t offset[kMaxHuffmanLength + 1];
+    
+    HuffmanCode() {
+        uint16_t position = 0;
+        uint32_t code = 0;
+        for (int length = 0; length <= kMaxHuffmanLength; ++length) {
+            first_code[length] = code;
+            offset[length] = position;
+            count[length] = 0;
+            for (uint16_t symbol = 0; symbol <= kEos; ++symbol) {
+                if (kHuffmanLengths[symbol] == length) {
+                    symbols[position++] = symbol;
+                    codes[symbol] = code++;
+                    ++count[length];
+                }
+            }
+            code <<= 1;
+        }
+    }
+};
+
+const HuffmanCode& huffman_code() {
+    static const HuffmanCode code;
+    return code;
+}
+
+void encode_integer(uint64_t value, int prefix_bits, uint8_t flags, std::string& out) {
+    uint64_t prefix_max = (1u << prefix_bits) - 1;
+    if (value < prefix_max) {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    
+    out.push_back(static_cast<char>(flags | prefix_max));
+    value -= prefix_max;
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+bool decode_integer(const uint8_t*& data, const uint8_t* end, int prefix_bits, uint64_t& value) {
+    if (data == end) return false;
+    
+    uint64_t prefix_max = (1u << prefix_bits) - 1;
+    value = *data++ & prefix_max;
+    if (value < prefix_max) return true;
+    
+    // Nothing legitimate needs more than a few continuation bytes
+    for (int shift = 0; data != end && shift <= 28; shift += 7) {
+        uint8_t byte = *data++;
+        value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void encode_string(const std::string& text, std::string& out) {
+    size_t huffman_length = HpackHuffman::encoded_length(text);
+    if (huffman_length < text.length()) {
+        encode_integer(huffman_length, 7, 0x80, out);
+        HpackHuffman::encode(text, out);
+    } else {
+        encode_integer(text.length(), 7, 0x00, out);
+        out += text;
+    }
+}
+
+bool decode_string(const uint8_t*& data, const uint8_t* end, std::string& out) {
+    if (data == end) return false;
+    
+    bool huffman = *data & 0x80;
+    uint64_t length;
+    if (!decode_integer(data, end, 7, length) || length > static_cast<uint64_t>(end - data)) {
+        return false;
+    }
+    
+    out.clear();
+    if (huffman) {
+        if (!HpackHuffman::decode(data, length, out)) return false;
+    } else {
+        out.assign(reinterpret_cast<const char*>(data), length);
+    }
+    data += length;
+    return true;
+}
+
+// Entry size as accounted by the table and the header list limit
+size_t field_size(const std::string& name, const std::string& value) {
+    return name.length() + value.length() + 32;
+}
+
+}
+
+HpackTable::HpackTable(size_t max_size)
+    : size_(0), max_size_(max_size) {
+}
+
+void HpackTable::set_max_size(size_t max_size) {
+    max_size_ = max_size;
+    evict(max_size_);
+}
+
+void HpackTable::add(const std::string& name, const std::string& value) {
+    size_t entry_size = field_size(name, value);
+    
+    // An entry larger than the table empties it and is not added
+    if (entry_size > max_size_) {
+        entries_.clear();
+        size_ = 0;
+        return;
+    }
+    
+    evict(max_size_ - entry_size);
+    entries_.emplace_front(name, value);
+    size_ += entry_size;
+}
+
+const HeaderField* HpackTable::get(size_t index) const {
+    if (index == 0) return nullptr;
+    if (index <= kStaticTableSize) return &kStaticTable[index - 1];
+    
+    index -= kStaticTableSize + 1;
+    return index < entries_.size() ? &entries_[index] : nullptr;
+}
+
+size_t HpackTable::find(const std::string& name, const std::string& value, bool& name_only) const {
+    size_t name_index = 0;
+    
+    for (size_t i = 0; i < kStaticTableSize; ++i) {
+        if (kStaticTable[i].first != name) continue;
+        if (kStaticTable[i].second == value) {
+            name_only = false;
+            return i + 1;
+        }
+        if (name_index == 0) name_index = i + 1;
+    }
+    
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        if (entries_[i].first != name) continue;
+        if (entries_[i].second == value) {
+            name_only = false;
+            return kStaticTableSize + 1 + i;
+        }
+        if (name_index == 0) name_index = kStaticTableSize + 1 + i;
+    }
+    
+    name_only = true;
+    return name_index;
+}
+
+void HpackTable::evict(size_t max_size) {
+    while (size_ > max_size) {
+        size_ -= field_size(entries_.back().first, entries_.back().second);
+        entries_.pop_back();
+    }
+}
+
+HpackDecoder::HpackDecoder()
+    : max_table_size_(HpackTable::kDefaultMaxSize), max_header_list_size_(SIZE_MAX), truncated_(false) {
+}
+
+bool HpackDecoder::decode(const uint8_t* data, size_t length, std::vector<HeaderField>& headers) {
+    const uint8_t* end = data + length;
+    size_t list_size = 0;
+    bool block_start = true;
+    truncated_ = false;
+    
+    while (data != end) {
+        uint8_t byte = *data;
+        uint64_t index;
+        std::string name, value;
+        
+        if (byte & 0x80) {
+            // Indexed field
+            if (!decode_integer(data, end, 7, index)) return false;
+            const HeaderField* field = table_.get(index);
+            if (!field) return false;
+            name = field->first;
+            value = field->second;
+        } else if ((byte & 0xe0) == 0x20) {
+            // Dynamic table size update, only allowed before the first field
+            if (!block_start || !decode_integer(data, end, 5, index) || index > max_table_size_) {
+                return false;
+            }
+            table_.set_max_size(index);
+            continue;
+        } else {
+            // Literal field: with incremental indexing (01), without indexing (0000)
+            // or never indexed (0001); the name is indexed or literal
+            bool indexing = byte & 0x40;
+            if (!decode_integer(data, end, indexing ? 6 : 4, index)) return false;
+            if (index != 0) {
+                const HeaderField* field = table_.get(index);
+                if (!field) return false;
+                name = field->first;
+            } else if (!decode_string(data, end, name)) {
+                return false;
+            }
+            if (!decode_string(data, end, value)) return false;
+            if (indexing) {
+                table_.add(name, value);
+            }
+        }
+        
+        block_start = false;
+        list_size += field_size(name, value);
+        if (list_size > max_header_list_size_) {
+            truncated_ = true;
+        } else {
+            headers.emplace_back(std::move(name), std::move(value));
+        }
+    }
+    
+    return true;
+}
+
+HpackEncoder::HpackEncoder()
+    : pending_min_size_(0), size_update_pending_(false) {
+}
+
+void HpackEncoder::set_max_table_size(size_t max_size) {
+    size_t new_size = std::min(max_size, HpackTable::kDefaultMaxSize);
+    if (!size_update_pending_ && new_size == table_.get_max_size()) return;
+    
+    pending_min_size_ = size_update_pending_ ? std::min(pending_min_size_, new_size) : new_size;
+    size_update_pending_ = true;
+    table_.set_max_size(new_size);
+}
+
+void HpackEncoder::encode(const std::vector<HeaderField>& headers, std::string& out) {
+    // If the table shrank and grew again since the last block, the peer must see both
+    if (size_update_pending_) {
+        if (pending_min_size_ < table_.get_max_size()) {
+            encode_integer(pending_min_size_, 5, 0x20, out);
+        }
+        encode_integer(table_.get_max_size(), 5, 0x20, out);
+        size_update_pending_ = false;
+    }
+    
+    for (const auto& header : headers) {
+        bool name_only = false;
+        size_t index = table_.find(header.first, header.second, name_only);
+        if (index != 0 && !name_only) {
+            encode_integer(index, 7, 0x80, out);
+            continue;
+        }
+        
+        // Per-response values would only churn the table, and cookies stay out of it
+        if (header.first == "content-length") {
+            encode_integer(index, 4, 0x00, out);
+        } else if (header.first == "set-cookie") {
+            encode_integer(index, 4, 0x10, out);
+        } else {
+            encode_integer(index, 6, 0x40, out);
+            table_.add(header.first, header.second);
+        }
+        if (index == 0) {
+            encode_string(header.first, out);
+        }
+        encode_string(header.second, out);
+    }
+}
+
+bool HpackHuffman::decode(const uint8_t* data, size_t length, std::string& out) {
+    const HuffmanCode& huffman = huffman_code();
+    uint32_t code = 0;
+    int code_length = 0;
+    
+    for (size_t i = 0; i < length; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((data[i] >> bit) & 1);
+            ++code_length;
+            
+            uint32_t rank = code - huffman.first_code[code_length];
+            if (rank < huffman.count[code_length]) {
+                uint16_t symbol = huffman.symbols[huffman.offset[code_length] + rank];
+                if (symbol == kEos) return false;
+                out.push_back(static_cast<char>(symbol));
+                code = 0;
+                code_length = 0;
+            } else if (code_length == kMaxHuffmanLength) {
+                return false;
+            }
+        }
+    }
+    
+    // Padding is a prefix of EOS: at most 7 one bits
+    return code_length <= 7 && code == (1u << code_length) - 1;
+}
+
+void HpackHuffman::encode(const std::string& text, std::string& out) {
+    const HuffmanCode& huffman = huffman_code();
+    uint64_t bits = 0;
+    int pending = 0;
+    
+    for (unsigned char c : text) {
+        bits = (bits << kHuffmanLengths[c]) | huffman.codes[c];
+        pending += kHuffmanLengths[c];
+        while (pending >= 8) {
+            pending -= 8;
+            out.push_back(static_cast<char>(bits >> pending));
+        }
+        bits &= (1u << pending) - 1;
+    }
+    
+    // Pad the last byte with the most significant bits of EOS (all ones)
+    if (pending > 0) {
+        out.push_back(static_cast<char>((bits << (8 - pending)) | (0xff >> pending)));
+    }
+}
+
+size_t HpackHuffman::encoded_length(const std::string& text) {
+    size_t bits = 0;
+    for (unsigned char c : text) {
+        bits += kHuffmanLengths[c];
+    }
+    return (bits + 7) / 8;
+}
@@ -0,0 +1,902 @@
+#include "http2_connection.h"
+#include "trace.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace {
+
+constexpr uint8_t kFlagEndStream = 0x1;
+constexpr uint8_t kFlagAck = 0x1;
+constexpr uint8_t kFlagEndHeaders = 0x4;
+constexpr uint8_t kFlagPadded = 0x8;
+constexpr uint8_t kFlagPriority = 0x20;
+
+constexpr uint16_t kSettingsHeaderTableSize = 0x1;
+constexpr uint16_t kSettingsEnablePush = 0x2;
+constexpr uint16_t kSettingsMaxConcurrentStreams = 0x3;
+constexpr uint16_t kSettingsInitialWindowSize = 0x4;
+constexpr uint16_t kSettingsMaxFrameSize = 0x5;
+constexpr uint16_t kSettingsMaxHeaderListSize = 0x6;
+
+constexpr int kPollIntervalMs = 100;
+
+uint32_t read_u32(const uint8_t* data) {
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+           (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+void append_u16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+void append_u32(std::string& out, uint32_t value) {
+    append_u16(out, static_cast<uint16_t>(value >> 16));
+    append_u16(out, static_cast<uint16_t>(value));
+}
+
+// HTTP2-Settings is base64url without padding
+bool base64url_decode(const std::string& text, std::string& out) {
+    uint32_t bits = 0;
+    int pending = 0;
+    for (char c : text) {
+        int value;
+        if (c >= 'A' && c <= 'Z') value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '-' || c == '+') value = 62;
+        else if (c == '_' || c == '/') value = 63;
+        else if (c == '=') break;
+        else return false;
+        
+        bits = (bits << 6) | value;
+        pending += 6;
+        if (pending >= 8) {
+            pending -= 8;
+            out.push_back(static_cast<char>(bits >> pending));
+        }
+    }
+    return true;
+}
+
+// Whether a comma-separated header value contains token (case-insensitive)
+bool has_token(const std::string& value, const char* token) {
+    size_t start = 0;
+    while (start <= value.length()) {
+        size_t end = std::min(value.find(',', start), value.length());
+        std::string item = value.substr(start, end - start);
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (strcasecmp(item.c_str(), token) == 0) {
+            return true;
+        }
+        start = end + 1;
+    }
+    return false;
+}
+
+// Hop-by-hop headers have no meaning in HTTP/2 and make a message malformed
+bool is_connection_specific(const std::string& name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+}
+
+Http2Connection::Http2Connection(Connection& connection, RouteHandler& route_handler,
+                                 const std::atomic<bool>& running, size_t max_body_size)
+    : connection_(connection), route_handler_(route_handler), running_(running),
+      max_body_size_(max_body_size), input_offset_(0), last_stream_id_(0),
+      header_stream_id_(0), header_end_stream_(false),
+      send_window_(kDefaultWindow), recv_window_(kDefaultWindow),
+      peer_initial_window_(kDefaultWindow), peer_max_frame_size_(kMaxFrameSize),
+      goaway_sent_(false), peer_goaway_(false), closing_(false), broken_(false),
+      last_activity_(std::chrono::steady_clock::now()),
+      event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    decoder_.set_max_header_list_size(kMaxHeaderListSize);
+}
+
+Http2Connection::~Http2Connection() {
+    // Handlers still running refer to the route handler and to completed_
+    for (auto& worker : workers_) {
+        worker.second.join();
+    }
+    if (event_fd_ >= 0) {
+        close(event_fd_);
+    }
+}
+
+bool Http2Connection::is_upgrade_request(const HTTPRequest& request) {
+    return has_token(request.get_header("Upgrade"), "h2c") && request.has_header("HTTP2-Settings");
+}
+
+bool Http2Connection::upgrade(const HTTPRequest& request) {
+    // The settings count as the client's first SETTINGS frame; the 101 acknowledges them
+    std::string settings;
+    if (!base64url_decode(request.get_header("HTTP2-Settings"), settings) || settings.length() % 6 != 0 ||
+        !apply_settings(reinterpret_cast<const uint8_t*>(settings.data()), settings.length())) {
+        return false;
+    }
+    
+    // The request itself becomes stream 1, already half-closed by the client
+    last_stream_id_ = 1;
+    Stream& stream = streams_[1];
+    stream.send_window = peer_initial_window_;
+    stream.recv_window = kStreamWindow;
+    stream.head_request = request.get_method() == HTTPRequest::Method::HEAD;
+    stream.request_complete = true;
+    dispatch(1, request);
+    return true;
+}
+
+void Http2Connection::serve(const std::string& received) {
+    if (event_fd_ < 0) return;
+    
+    // Frames are batched in output_ already; Nagle would only delay flow-control round trips
+    int nodelay = 1;
+    setsockopt(connection_.get_fd(), IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    
+    input_ = received;
+    write_settings();
+    if (!flush()) return;
+    
+    // Client connection preface; a client that doesn't send it times out
+    while (input_.length() < kPrefaceLength) {
+        size_t received_length = input_.length();
+        if (!read_input() || input_.length() == received_length) return;
+    }
+    if (input_.compare(0, kPrefaceLength, kPreface) != 0) {
+        connection_error(ErrorCode::PROTOCOL_ERROR);
+        flush();
+        return;
+    }
+    input_offset_ = kPrefaceLength;
+    
+    while (true) {
+        process_input();
+        collect_responses();
+        write_data();
+        
+        // Server shutting down: refuse new streams and finish the ones in flight
+        if (!running_ && !goaway_sent_) {
+            write_goaway(ErrorCode::NO_ERROR);
+        }
+        if (!flush() || closing_) break;
+        
+        if (streams_.empty() && workers_.empty()) {
+            if (goaway_sent_ || peer_goaway_) break;
+            if (std::chrono::steady_clock::now() - last_activity_ > kIdleTimeout) {
+                write_goaway(ErrorCode::NO_ERROR);
+                flush();
+                break;
+            }
+        }
+        
+        if (!wait_for_input()) break;
+    }
+}
+
+bool Http2Connection::read_input() {
+    char buffer[16384];
+    ssize_t bytes_read;
+    {
+        TRACE_SCOPE(RECV);
+        bytes_read = connection_.read(buffer, sizeof(buffer));
+    }
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return true;
+    }
+    if (bytes_read <= 0) {
+        broken_ = true;
+        return false;
+    }
+    
+    // Only a partial frame is left over, so this moves little
+    input_.erase(0, input_offset_);
+    input_offset_ = 0;
+    input_.append(buffer, bytes_read);
+    last_activity_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool Http2Connection::wait_for_input() {
+    // TLS may hold decrypted bytes the socket no longer signals
+    if (connection_.has_buffered_data()) {
+        return read_input();
+    }
+    
+    // Wake up for client frames, finished handlers, or periodically to notice shutdown
+    struct pollfd fds[2] = {{connection_.get_fd(), POLLIN, 0}, {event_fd_, POLLIN, 0}};
+    int ready = poll(fds, 2, kPollIntervalMs);
+    if (ready < 0) {
+        return errno == EINTR;
+    }
+    
+    if (fds[1].revents & POLLIN) {
+        uint64_t count;
+        ssize_t ignored = read(event_fd_, &count, sizeof(count));
+        (void)ignored;
+    }
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+        return read_input();
+    }
+    return true;
+}
+
+void Http2Connection::process_input() {
+    while (!closing_ && input_.length() - input_offset_ >= 9) {
+        const uint8_t* frame = reinterpret_cast<const uint8_t*>(input_.data()) + input_offset_;
+        size_t length = (static_cast<size_t>(frame[0]) << 16) | (frame[1] << 8) | frame[2];
+        if (length > kMaxFrameSize) {
+            connection_error(ErrorCode::FRAME_SIZE_ERROR);
+            return;
+        }
+        if (input_.length() - input_offset_ < 9 + length) {
+            return;
+        }
+        
+        input_offset_ += 9 + length;
+        handle_frame(static_cast<FrameType>(frame[3]), frame[4], read_u32(frame + 5) & 0x7fffffff,
+                     frame + 9, length);
+    }
+}
+
+void Http2Connection::handle_frame(FrameType type, uint8_t flags, uint32_t stream_id,
+                                   const uint8_t* payload, size_t length) {
+    // Nothing may interleave with a header block
+    if (header_stream_id_ != 0 && (type != FrameType::CONTINUATION || stream_id != header_stream_id_)) {
+        connection_error(ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    
+    switch (type) {
+        case FrameType::DATA:
+            handle_data(flags, stream_id, payload, length);
+            break;
+        case FrameType::HEADERS:
+            handle_headers(flags, stream_id, payload, length);
+            break;
+        case FrameType::CONTINUATION:
+            if (header_stream_id_ == 0) {
+                connection_error(ErrorCode::PROTOCOL_ERROR);
+            } else {
+                handle_continuation(flags, payload, length);
+            }
+            break;
+        case FrameType::PRIORITY:
+            // Advisory only; responses are interleaved round-robin
+            if (stream_id == 0) {
+                connection_error(ErrorCode::PROTOCOL_ERROR);
+            } else if (length != 5) {
+                stream_error(stream_id, ErrorCode::FRAME_SIZE_ERROR);
+            }
+            break;
+        case FrameType::RST_STREAM:
+            if (stream_id == 0 || is_idle(stream_id)) {
+                connection_error(ErrorCode::PROTOCOL_ERROR);
+            } else if (length != 4) {
+                connection_error(ErrorCode::FRAME_SIZE_ERROR);
+            } else {
+                // A handler still running for it finishes unseen
+                streams_.erase(stream_id);
+            }
+            break;
+        case FrameType::SETTINGS:
+            handle_settings(flags, stream_id, payload, length);
+            break;
+        case FrameType::PING:
+            if (stream_id != 0) {
+                connection_error(ErrorCode::PROTOCOL_ERROR);
+            } else if (length != 8) {
+                connection_error(ErrorCode::FRAME_SIZE_ERROR);
+            } else if (!(flags & kFlagAck)) {
+                write_frame_header(8, FrameType::PING, kFlagAck, 0);
+                output_.append(reinterpret_cast<const char*>(payload), 8);
+            }
+            break;
+        case FrameType::GOAWAY:
+            if (stream_id != 0) {
+                connection_error(ErrorCode::PROTOCOL_ERROR);
+            } else if (length < 8) {
+                connection_error(ErrorCode::FRAME_SIZE_ERROR);
+            } else {
+                // The client opens no more streams; finish the open ones, then close
+                peer_goaway_ = true;
+            }
+            break;
+        case FrameType::WINDOW_UPDATE:
+            handle_window_update(stream_id, payload, length);
+            break;
+        case FrameType::PUSH_PROMISE:
+            connection_error(ErrorCode::PROTOCOL_ERROR);
+            break;
+        default:
+            // Unknown frame types are ignored
+            break;
+    }
+}
+
+void Http2Connection::handle_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length) {
+    if (stream_id == 0) {
+        connection_error(ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    
+    size_t padding = 0;
+    if (flags & kFlagPadded) {
+        if (length < 1) {
+            connection_error(ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        padding = payload[0];
+        ++payload;
+        --length;
+    }
+    if (flags & kFlagPriority) {
+        if (length < 5) {
+            connection_error(ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        payload += 5;
+        length -= 5;
+    }
+    if (padding > length) {
+        connection_error(ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    
+    header_stream_id_ = stream_id;
+    header_end_stream_ = flags & kFlagEndStream;
+    header_block_.assign(reinterpret_cast<const char*>(payload), length - padding);
+    if (flags & kFlagEndHeaders) {
+        handle_header_block();
+    }
+}
+
+void Http2Connection::handle_continuation(uint8_t flags, const uint8_t* payload, size_t length) {
+    // The compressed block is bounded too, since it has to be decoded either way
+    if (header_block_.length() + length > kMaxHeaderListSize) {
+        connection_error(ErrorCode::ENHANCE_YOUR_CALM);
+        return;
+    }
+    
+    header_block_.append(reinterpret_cast<const char*>(payload), length);
+    if (flags & kFlagEndHeaders) {
+        handle_header_block();
+    }
+}
+
+void Http2Connection::handle_header_block() {
+    TRACE_SCOPE(PARSE);
+    
+    uint32_t stream_id = header_stream_id_;
+    header_stream_id_ = 0;
+    
+    // Every block is decoded, even for refused streams, to keep the HPACK state in sync
+    std::vector<HeaderField> headers;
+    if (!decoder_.decode(reinterpret_cast<const uint8_t*>(header_block_.data()), header_block_.length(), headers)) {
+        connection_error(ErrorCode::COMPRESSION_ERROR);
+        return;
+    }
+    
+    auto it = streams_.find(stream_id);
+    if (it != streams_.end()) {
+        // Trailers: they end the request and are otherwise ignored
+        if (!header_end_stream_ || it->second.request_complete) {
+            stream_error(stream_id, ErrorCode::PROTOCOL_ERROR);
+        } else {
+            end_request(stream_id, it->second);
+        }
+        return;
+    }
+    
+    // Client streams are odd and opened in increasing order
+    if (stream_id % 2 == 0 || stream_id <= last_stream_id_) {
+        connection_error(ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    
+    // After a GOAWAY new streams are ignored; the client retries them elsewhere
+    if (goaway_sent_) {
+        return;
+    }
+    last_stream_id_ = stream_id;
+    
+    if (active_stream_count() >= kMaxConcurrentStreams) {
+        write_rst_stream(stream_id, ErrorCode::REFUSED_STREAM);
+        return;
+    }
+    
+    open_stream(stream_id, headers, header_end_stream_);
+}
+
+size_t Http2Connection::active_stream_count() const {
+    // A reset stream is gone from streams_, but its handler thread runs on until it returns,
+    // so it still counts (otherwise HEADERS + RST_STREAM could spawn threads without limit)
+    size_t count = streams_.size();
+    for (const auto& worker : workers_) {
+        if (!streams_.count(worker.first)) ++count;
+    }
+    return count;
+}
+
+void Http2Connection::open_stream(uint32_t stream_id, const std::vector<HeaderField>& headers, bool end_stream) {
+    Stream& stream = streams_[stream_id];
+    stream.send_window = peer_initial_window_;
+    stream.recv_window = kStreamWindow;
+    
+    // Pseudo-headers first, then lowercase regular headers
+    HTTPRequest& request = stream.request;
+    request.set_version("HTTP/2.0");
+    std::string method, path, authority;
+    bool malformed = false;
+    bool regular_seen = false;
+    
+    for (const auto& header : headers) {
+        const std::string& name = header.first;
+        if (!name.empty() && name[0] == ':') {
+            if (name == ":method") method = header.second;
+            else if (name == ":path") path = header.second;
+            else if (name == ":authority") authority = header.second;
+            else if (name != ":scheme") malformed = true;
+            malformed |= regular_seen;
+            continue;
+        }
+        
+        regular_seen = true;
+        if (is_connection_specific(name) ||
+            std::any_of(name.begin(), name.end(), [](unsigned char c) { return std::isupper(c); })) {
+            malformed = true;
+        }
+        request.add_header(name, header.second);
+    }
+    
+    if (malformed || method.empty() || path.empty()) {
+        stream_error(stream_id, ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    
+    request.set_method(method);
+    request.set_target(path);
+    if (!authority.empty() && !request.has_header("Host")) {
+        request.add_header("host", authority);
+    }
+    stream.head_request = request.get_method() == HTTPRequest::Method::HEAD;
+    
+    // Refuse what can be refused before the body arrives
+    size_t content_length = 0;
+    if (decoder_.is_truncated()) {
+        start_response(stream_id, HTTPResponse::bad_request("Request header too large"));
+    } else if (!request.get_content_length(content_length)) {
+        start_response(stream_id, HTTPResponse::bad_request("Invalid Content-Length"));
+    } else if (content_length > max_body_size_) {
+        start_response(stream_id, HTTPResponse::payload_too_large());
+    } else if (const auto* factory = route_handler_.find_multipart_route(request)) {
+        // Uploads are streamed through the parser as DATA frames arrive
+        std::string boundary = MultipartParser::boundary_from_content_type(request.get_header("Content-Type"));
+        if (boundary.empty()) {
+            start_response(stream_id, HTTPResponse::bad_request("Expected multipart/form-data with a boundary"));
+        } else {
+            stream.multipart_handler = (*factory)(request);
+            stream.multipart_parser = std::make_unique<MultipartParser>(boundary, *stream.multipart_handler);
+        }
+    }
+    
+    if (end_stream) {
+        end_request(stream_id, stream);
+    }
+}
+
+void Http2Connection::handle_data(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length) {
+    if (stream_id == 0) {
+        connection_error(ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    
+    // Flow control counts the whole payload, padding included
+    size_t frame_length = length;
+    if (flags & kFlagPadded) {
+        if (length < 1 || payload[0] > length - 1) {
+            connection_error(ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        length -= 1 + payload[0];
+        ++payload;
+    }
+    
+    if (static_cast<int64_t>(frame_length) > recv_window_) {
+        connection_error(ErrorCode::FLOW_CONTROL_ERROR);
+        return;
+    }
+    recv_window_ -= frame_length;
+    
+    // Bodies are consumed (or dropped) as they arrive, so windows are reopened straight away
+    if (recv_window_ < kConnectionWindow / 2) {
+        write_window_update(0, static_cast<uint32_t>(kConnectionWindow - recv_window_));
+        recv_window_ = kConnectionWindow;
+    }
+    
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        // Data for a stream we have already closed or reset is dropped
+        if (is_idle(stream_id)) {
+            connection_error(ErrorCode::PROTOCOL_ERROR);
+        }
+        return;
+    }
+    
+    Stream& stream = it->second;
+    if (stream.request_complete) {
+        stream_error(stream_id, ErrorCode::STREAM_CLOSED);
+        return;
+    }
+    if (static_cast<int64_t>(frame_length) > stream.recv_window) {
+        stream_error(stream_id, ErrorCode::FLOW_CONTROL_ERROR);
+        return;
+    }
+    stream.recv_window -= frame_length;
+    
+    // Answered early and fully sent: ask the client to stop sending the body. Doing this
+    // only now, rather than right behind the response, keeps clients that act on the
+    // reset before reading the response from losing it.
+    if (stream.responding && stream.remaining == 0) {
+        stream_error(stream_id, ErrorCode::NO_ERROR);
+        return;
+    }
+    
+    const char* data = reinterpret_cast<const char*>(payload);
+    if (stream.discard_body) {
+        // Answered already
+    } else if (stream.multipart_parser) {
+        stream.multipart_ok = stream.multipart_parser->feed(data, length);
+        stream.discard_body = !stream.multipart_ok;
+    } else if (stream.body.length() + length > max_body_size_) {
+        start_response(stream_id, HTTPResponse::payload_too_large());
+    } else {
+        stream.body.append(data, length);
+    }
+    
+    if (flags & kFlagEndStream) {
+        end_request(stream_id, stream);
+    } else if (stream.recv_window < kStreamWindow / 2) {
+        write_window_update(stream_id, static_cast<uint32_t>(kStreamWindow - stream.recv_window));
+        stream.recv_window = kStreamWindow;
+    }
+}
+
+void Http2Connection::handle_settings(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t length) {
+    if (stream_id != 0) {
+        connection_error(ErrorCode::PROTOCOL_ERROR);
+        return;
+    }
+    if (flags & kFlagAck) {
+        if (length != 0) {
+            connection_error(ErrorCode::FRAME_SIZE_ERROR);
+        }
+        return;
+    }
+    if (length % 6 != 0) {
+        connection_error(ErrorCode::FRAME_SIZE_ERROR);
+        return;
+    }
+    
+    if (apply_settings(payload, length)) {
+        write_frame_header(0, FrameType::SETTINGS, kFlagAck, 0);
+    }
+}
+
+bool Http2Connection::apply_settings(const uint8_t* payload, size_t length) {
+    for (size_t i = 0; i + 6 <= length; i += 6) {
+        uint16_t id = static_cast<uint16_t>((payload[i] << 8) | payload[i + 1]);
+        uint32_t value = read_u32(payload + i + 2);
+        
+        switch (id) {
+            case kSettingsHeaderTableSize:
+                encoder_.set_max_table_size(value);
+                break;
+            case kSettingsEnablePush:
+                if (value > 1) {
+                    connection_error(ErrorCode::PROTOCOL_ERROR);
+                    return false;
+                }
+                break;
+            case kSettingsInitialWindowSize: {
+                if (value > kMaxWindow) {
+                    connection_error(ErrorCode::FLOW_CONTROL_ERROR);
+                    return false;
+                }
+                // Applies retroactively to every open stream
+                int64_t delta = static_cast<int64_t>(value) - peer_initial_window_;
+                peer_initial_window_ = value;
+                for (auto& entry : streams_) {
+                    entry.second.send_window += delta;
+                    if (entry.second.send_window > kMaxWindow) {
+                        connection_error(ErrorCode::FLOW_CONTROL_ERROR);
+                        return false;
+                    }
+                }
+                break;
+            }
+            case kSettingsMaxFrameSize:
+                if (value < kMaxFrameSize || value > 0xffffff) {
+                    connection_error(ErrorCode::PROTOCOL_ERROR);
+                    return false;
+                }
+                peer_max_frame_size_ = value;
+                break;
+            default:
+                // We never push, and unknown settings are ignored
+                break;
+        }
+    }
+    return true;
+}
+
+void Http2Connection::handle_window_update(uint32_t stream_id, const uint8_t* payload, size_t length) {
+    if (length != 4) {
+        connection_error(ErrorCode::FRAME_SIZE_ERROR);
+        return;
+    }
+    uint32_t increment = read_u32(payload) & 0x7fffffff;
+    
+    if (stream_id == 0) {
+        send_window_ += increment;
+        if (increment == 0) {
+            connection_error(ErrorCode::PROTOCOL_ERROR);
+        } else if (send_window_ > kMaxWindow) {
+            connection_error(ErrorCode::FLOW_CONTROL_ERROR);
+        }
+        return;
+    }
+    
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) {
+        if (is_idle(stream_id)) {
+            connection_error(ErrorCode::PROTOCOL_ERROR);
+        }
+        return;
+    }
+    
+    it->second.send_window += increment;
+    if (increment == 0) {
+        stream_error(stream_id, ErrorCode::PROTOCOL_ERROR);
+    } else if (it->second.send_window > kMaxWindow) {
+        stream_error(stream_id, ErrorCode::FLOW_CONTROL_ERROR);
+    }
+}
+
+void Http2Connection::end_request(uint32_t stream_id, Stream& stream) {
+    stream.request_complete = true;
+    if (stream.responding) {
+        return;
+    }
+    
+    if (stream.multipart_handler) {
+        start_response(stream_id, stream.multipart_handler->finish(stream.multipart_ok &&
+                                                                   stream.multipart_parser->is_complete()));
+        return;
+    }
+    
+    stream.request.set_body(std::move(stream.body));
+    dispatch(stream_id, std::move(stream.request));
+}
+
+void Http2Connection::dispatch(uint32_t stream_id, HTTPRequest request) {
+    workers_.emplace(stream_id, std::thread([this, stream_id, request = std::move(request)]() {
+        TRACE_BEGIN_REQUEST();
+        TRACE_SCOPE(STREAM);
+        HTTPResponse response = route_handler_.handle_request(request);
+        {
+            std::lock_guard<std::mutex> lock(completed_mutex_);
+            completed_.emplace_back(stream_id, std::move(response));
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(event_fd_, &one, sizeof(one));
+        (void)ignored;
+    }));
+}
+
+void Http2Connection::collect_responses() {
+    std::vector<std::pair<uint32_t, HTTPResponse>> completed;
+    {
+        std::lock_guard<std::mutex> lock(completed_mutex_);
+        completed.swap(completed_);
+    }
+    
+    for (auto& result : completed) {
+        auto worker = workers_.find(result.first);
+        if (worker != workers_.end()) {
+            worker->second.join();
+            workers_.erase(worker);
+        }
+        // The client may have reset the stream in the meantime
+        if (streams_.count(result.first)) {
+            start_response(result.first, result.second);
+        }
+    }
+}
+
+void Http2Connection::start_response(uint32_t stream_id, const HTTPResponse& response) {
+    Stream& stream = streams_.at(stream_id);
+    stream.responding = true;
+    stream.discard_body = true;
+    
+    // Reuse the HTTP/1.1 head so cached responses go out unchanged
+    std::string head;
+    size_t body_length;
+    if (response.has_file_body()) {
+        stream.response = response;
+        head = response.head_to_string();
+        body_length = response.get_file_size();
+    } else {
+        stream.serialized = response.serialize();
+        size_t head_end = std::min(stream.serialized->find("\r\n\r\n"), stream.serialized->length());
+        head = stream.serialized->substr(0, head_end + 2);
+        stream.data = stream.serialized->data() + std::min(head_end + 4, stream.serialized->length());
+        body_length = stream.serialized->data() + stream.serialized->length() - stream.data;
+    }
+    
+    std::vector<HeaderField> fields;
+    fields.emplace_back(":status", head.length() >= 12 ? head.substr(9, 3) : "500");
+    bool has_content_length = false;
+    for (size_t pos = head.find("\r\n"); pos != std::string::npos && pos + 2 < head.length();) {
+        size_t line_end = head.find("\r\n", pos + 2);
+        size_t colon = head.find(':', pos + 2);
+        if (line_end == std::string::npos) break;
+        if (colon < line_end) {
+            std::string name = head.substr(pos + 2, colon - pos - 2);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            size_t value_start = head.find_first_not_of(" \t", colon + 1);
+            std::string value = value_start < line_end ? head.substr(value_start, line_end - value_start) : "";
+            if (!is_connection_specific(name)) {
+                has_content_length |= name == "content-length";
+                fields.emplace_back(std::move(name), std::move(value));
+            }
+        }
+        pos = line_end;
+    }
+    if (!has_content_length) {
+        fields.emplace_back("content-length", std::to_string(body_length));
+    }
+    
+    stream.remaining = stream.head_request ? 0 : body_length;
+    
+    // Header blocks aren't flow controlled; split across CONTINUATION frames if needed
+    std::string block;
+    encoder_.encode(fields, block);
+    size_t offset = 0;
+    FrameType type = FrameType::HEADERS;
+    do {
+        size_t length = std::min(block.length() - offset, peer_max_frame_size_);
+        uint8_t flags = offset + length == block.length() ? kFlagEndHeaders : 0;
+        if (type == FrameType::HEADERS && stream.remaining == 0) {
+            flags |= kFlagEndStream;
+        }
+        write_frame_header(length, type, flags, stream_id);
+        output_.append(block, offset, length);
+        offset += length;
+        type = FrameType::CONTINUATION;
+    } while (offset < block.length());
+}
+
+void Http2Connection::write_data() {
+    // One frame per stream per round, so concurrent responses interleave
+    bool progress = true;
+    while (progress && !broken_) {
+        progress = false;
+        for (auto& entry : streams_) {
+            Stream& stream = entry.second;
+            if (send_window_ <= 0) break;
+            if (!stream.responding || stream.remaining == 0 || stream.send_window <= 0) continue;
+            
+            size_t length = std::min({stream.remaining, peer_max_frame_size_, static_cast<size_t>(send_window_),
+                                      static_cast<size_t>(stream.send_window)});
+            stream.remaining -= length;
+            stream.send_window -= length;
+            send_window_ -= length;
+            write_frame_header(length, FrameType::DATA, stream.remaining == 0 ? kFlagEndStream : 0, entry.first);
+            
+            if (stream.response.has_file_body()) {
+                // The file range follows its frame header straight from the page cache
+                TRACE_SCOPE(SEND);
+                if (!flush() || !connection_.send_file(stream.response.get_file_fd(), length, stream.file_offset)) {
+                    broken_ = true;
+                    return;
+                }
+                stream.file_offset += length;
+            } else {
+                output_.append(stream.data, length);
+                stream.data += length;
+            }
+            
+            progress = true;
+            if (output_.length() >= kFlushThreshold && !flush()) {
+                return;
+            }
+        }
+    }
+    
+    // Streams whose response is fully queued are done. One answered before its request
+    // body ended stays open until more of the body arrives (see handle_data).
+    for (auto it = streams_.begin(); it != streams_.end();) {
+        if (it->second.responding && it->second.remaining == 0 && it->second.request_complete) {
+            it = streams_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Http2Connection::write_frame_header(size_t length, FrameType type, uint8_t flags, uint32_t stream_id) {
+    output_.push_back(static_cast<char>(length >> 16));
+    append_u16(output_, static_cast<uint16_t>(length));
+    output_.push_back(static_cast<char>(type));
+    output_.push_back(static_cast<char>(flags));
+    append_u32(output_, stream_id);
+}
+
+void Http2Connection::write_settings() {
+    write_frame_header(3 * 6, FrameType::SETTINGS, 0, 0);
+    append_u16(output_, kSettingsMaxConcurrentStreams);
+    append_u32(output_, kMaxConcurrentStreams);
+    append_u16(output_, kSettingsInitialWindowSize);
+    append_u32(output_, kStreamWindow);
+    append_u16(output_, kSettingsMaxHeaderListSize);
+    append_u32(output_, kMaxHeaderListSize);
+    
+    // The connection window can only be raised with a WINDOW_UPDATE
+    write_window_update(0, static_cast<uint32_t>(kConnectionWindow - kDefaultWindow));
+    recv_window_ = kConnectionWindow;
+}
+
+void Http2Connection::write_window_update(uint32_t stream_id, uint32_t increment) {
+    write_frame_header(4, FrameType::WINDOW_UPDATE, 0, stream_id);
+    append_u32(output_, increment);
+}
+
+void Http2Connection::write_rst_stream(uint32_t stream_id, ErrorCode code) {
+    write_frame_header(4, FrameType::RST_STREAM, 0, stream_id);
+    append_u32(output_, static_cast<uint32_t>(code));
+}
+
+void Http2Connection::write_goaway(ErrorCode code) {
+    write_frame_header(8, FrameType::GOAWAY, 0, 0);
+    append_u32(output_, last_stream_id_);
+    append_u32(output_, static_cast<uint32_t>(code));
+    goaway_sent_ = true;
+}
+
+void Http2Connection::stream_error(uint32_t stream_id, ErrorCode code) {
+    write_rst_stream(stream_id, code);
+    streams_.erase(stream_id);
+}
+
+void Http2Connection::connection_error(ErrorCode code) {
+    if (!closing_) {
+        write_goaway(code);
+        closing_ = true;
+    }
+}
+
+bool Http2Connection::flush() {
+    if (broken_) {
+        return false;
+    }
+    if (!output_.empty()) {
+        TRACE_SCOPE(SEND);
+        if (!connection_.write_all(output_.data(), output_.length())) {
+            broken_ = true;
+        }
+        output_.clear();
+    }
+    return !broken_;
+}
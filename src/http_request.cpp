@@ -1,25 +1,40 @@
 #include "http_request.h"
+#include "trace.h"
 #include <sstream>
 #include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <strings.h>
 
 HTTPRequest::HTTPRequest()
     : method_(Method::UNKNOWN), path_(""), version_(""), body_("") {
 }
 
 bool HTTPRequest::parse(const std::string& raw_request) {
+    TRACE_SCOPE(PARSE);
+    
     if (raw_request.empty()) {
         return false;
     }
     
-    // Split request into lines
-    std::istringstream stream(raw_request);
+    // The body starts after the first empty line and is kept byte-for-byte
+    size_t header_end = raw_request.find("\r\n\r\n");
+    if (header_end != std::string::npos) {
+        body_ = raw_request.substr(header_end + 4);
+    }
+    
+    // Split the head into lines
+    std::istringstream stream(raw_request.substr(0, header_end));
     std::string line;
     
     // Parse request line
     if (!std::getline(stream, line)) {
         return false;
     }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
     parse_request_line(line);
     
     // Parse headers
@@ -34,15 +49,6 @@ bool HTTPRequest::parse(const std::string& raw_request) {
     }
     parse_headers(header_lines);
     
-    // Parse body (if any)
-    std::string body_part;
-    while (std::getline(stream, line)) {
-        body_part += line + "\n";
-    }
-    if (!body_part.empty()) {
-        body_ = body_part.substr(0, body_part.length() - 1); // Remove trailing newline
-    }
-    
     return true;
 }
 
@@ -52,19 +58,31 @@ void HTTPRequest::parse_request_line(const std::string& line) {
     
     if (stream >> method_str >> path_str >> version_str) {
         method_ = parse_method(method_str);
-        path_ = path_str;
+        set_target(path_str);
         version_ = version_str;
-        
-        // Parse query string if present
-        size_t query_pos = path_.find('?');
-        if (query_pos != std::string::npos) {
-            std::string query_string = path_.substr(query_pos + 1);
-            path_ = path_.substr(0, query_pos);
-            parse_query_string(query_string);
-        }
     }
 }
 
+void HTTPRequest::set_target(const std::string& target) {
+    // Split off the query string; it is decoded lazily through query()
+    size_t query_pos = target.find('?');
+    path_ = target.substr(0, query_pos);
+    query_string_ = query_pos != std::string::npos ? target.substr(query_pos + 1) : "";
+}
+
+void HTTPRequest::add_header(const std::string& name, const std::string& value) {
+    auto inserted = headers_.emplace(name, value);
+    if (!inserted.second) {
+        // Cookies are the one header whose values are joined with "; "
+        inserted.first->second += strcasecmp(name.c_str(), "Cookie") == 0 ? "; " : ", ";
+        inserted.first->second += value;
+    }
+}
+
+bool HTTPRequest::HeaderNameLess::operator()(const std::string& a, const std::string& b) const {
+    return strcasecmp(a.c_str(), b.c_str()) < 0;
+}
+
 void HTTPRequest::parse_headers(const std::vector<std::string>& header_lines) {
     for (const auto& line : header_lines) {
         size_t colon_pos = line.find(':');
@@ -78,21 +96,7 @@ void HTTPRequest::parse_headers(const std::vector<std::string>& header_lines) {
             value.erase(0, value.find_first_not_of(" \t"));
             value.erase(value.find_last_not_of(" \t") + 1);
             
-            headers_[name] = value;
-        }
-    }
-}
-
-void HTTPRequest::parse_query_string(const std::string& query_string) {
-    std::istringstream stream(query_string);
-    std::string param;
-    
-    while (std::getline(stream, param, '&')) {
-        size_t equal_pos = param.find('=');
-        if (equal_pos != std::string::npos) {
-            std::string name = param.substr(0, equal_pos);
-            std::string value = param.substr(equal_pos + 1);
-            query_params_[name] = value;
+            add_header(name, value);
         }
     }
 }
@@ -111,6 +115,18 @@ HTTPRequest::Method HTTPRequest::parse_method(const std::string& method_str) {
     return Method::UNKNOWN;
 }
 
+std::string HTTPRequest::method_to_string(Method method) {
+    switch (method) {
+        case Method::GET: return "GET";
+        case Method::POST: return "POST";
+        case Method::PUT: return "PUT";
+        case Method::DELETE: return "DELETE";
+        case Method::HEAD: return "HEAD";
+        case Method::OPTIONS: return "OPTIONS";
+        default: return "UNKNOWN";
+    }
+}
+
 std::string HTTPRequest::get_header(const std::string& name) const {
     auto it = headers_.find(name);
     return (it != headers_.end()) ? it->second : "";
@@ -120,7 +136,49 @@ bool HTTPRequest::has_header(const std::string& name) const {
     return headers_.find(name) != headers_.end();
 }
 
+bool HTTPRequest::get_content_length(size_t& length) const {
+    length = 0;
+    auto it = headers_.find("Content-Length");
+    if (it == headers_.end()) {
+        return true;
+    }
+    
+    // strtoull alone would accept "12abc", " 12", "-1" and overflow
+    const std::string& value = it->second;
+    if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0]))) {
+        return false;
+    }
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long parsed = std::strtoull(value.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    length = static_cast<size_t>(parsed);
+    return true;
+}
+
 std::string HTTPRequest::get_query_param(const std::string& name) const {
-    auto it = query_params_.find(name);
-    return (it != query_params_.end()) ? it->second : "";
+    // Decoded values live in the params' arena, so it must outlive the copy
+    UrlEncodedParams params = query();
+    auto value = params.get(name);
+    return value ? std::string(*value) : "";
+}
+
+std::multimap<std::string, std::string> HTTPRequest::get_query_params() const {
+    std::multimap<std::string, std::string> params;
+    query().for_each([&params](std::string_view name, std::string_view value) {
+        params.emplace(std::string(name), std::string(value));
+    });
+    return params;
+}
+
+UrlEncodedParams HTTPRequest::form() const {
+    std::string content_type = get_header("Content-Type");
+    std::transform(content_type.begin(), content_type.end(), content_type.begin(), ::tolower);
+    
+    if (content_type.compare(0, 33, "application/x-www-form-urlencoded") != 0) {
+        return UrlEncodedParams();
+    }
+    return UrlEncodedParams(body_);
 } 
\ No newline at end of file
@@ -1,27 +1,64 @@
 #include "http_response.h"
 #include <sstream>
+#include <cstdlib>
+#include <unistd.h>
 
 HTTPResponse::HTTPResponse()
     : status_code_(StatusCode::OK) {
     // Set default headers
-    headers_["Server"] = "C++ HTTP Server";
-    headers_["Connection"] = "close";
+    headers_.emplace("Server", "C++ HTTP Server");
+    headers_.emplace("Connection", "close");
 }
 
 void HTTPResponse::set_content_type(const std::string& content_type) {
-    headers_["Content-Type"] = content_type;
+    add_header("Content-Type", content_type);
 }
 
 void HTTPResponse::add_header(const std::string& name, const std::string& value) {
-    headers_[name] = value;
+    headers_.erase(name);
+    headers_.emplace(name, value);
+}
+
+void HTTPResponse::append_header(const std::string& name, const std::string& value) {
+    headers_.emplace(name, value);
+}
+
+HTTPResponse::FileBody::~FileBody() {
+    close(fd);
+}
+
+void HTTPResponse::set_file_body(int fd, size_t size) {
+    file_body_.reset(new FileBody{fd, size});
+    body_.clear();
+    add_header("Content-Length", std::to_string(size));
 }
 
 std::string HTTPResponse::to_string() const {
+    if (serialized_) {
+        return *serialized_;
+    }
+    
+    std::string response = head_to_string();
+    
+    // Body
+    if (file_body_) {
+        size_t offset = response.length();
+        response.resize(offset + file_body_->size);
+        ssize_t n = pread(file_body_->fd, &response[offset], file_body_->size, 0);
+        response.resize(offset + (n > 0 ? n : 0));
+    } else {
+        response += body_;
+    }
+    
+    return response;
+}
+
+std::string HTTPResponse::head_to_string() const {
     std::ostringstream response;
     
     // Status line
     response << "HTTP/1.1 " << status_code_to_string(status_code_) << " "
-             << get_status_message(status_code_) << "\r\n";
+             << (status_message_.empty() ? get_status_message(status_code_) : status_message_) << "\r\n";
     
     // Headers
     for (const auto& header : headers_) {
@@ -31,14 +68,16 @@ std::string HTTPResponse::to_string() const {
     // Empty line separating headers from body
     response << "\r\n";
     
-    // Body
-    if (!body_.empty()) {
-        response << body_;
-    }
-    
     return response.str();
 }
 
+std::shared_ptr<const std::string> HTTPResponse::serialize() const {
+    if (serialized_) {
+        return serialized_;
+    }
+    return std::make_shared<const std::string>(to_string());
+}
+
 void HTTPResponse::set_json_response(const std::string& json_data) {
     body_ = json_data;
     set_content_type("application/json");
@@ -84,6 +123,51 @@ HTTPResponse HTTPResponse::internal_error(const std::string& message) {
     return response;
 }
 
+HTTPResponse HTTPResponse::length_required(const std::string& message) {
+    HTTPResponse response;
+    response.set_status_code(StatusCode::LENGTH_REQUIRED);
+    response.set_text_response(message);
+    return response;
+}
+
+HTTPResponse HTTPResponse::payload_too_large(const std::string& message) {
+    HTTPResponse response;
+    response.set_status_code(StatusCode::PAYLOAD_TOO_LARGE);
+    response.set_text_response(message);
+    return response;
+}
+
+HTTPResponse HTTPResponse::not_implemented(const std::string& message) {
+    HTTPResponse response;
+    response.set_status_code(StatusCode::NOT_IMPLEMENTED);
+    response.set_text_response(message);
+    return response;
+}
+
+HTTPResponse HTTPResponse::bad_gateway(const std::string& message) {
+    HTTPResponse response;
+    response.set_status_code(StatusCode::BAD_GATEWAY);
+    response.set_text_response(message);
+    return response;
+}
+
+HTTPResponse HTTPResponse::service_unavailable(const std::string& message) {
+    HTTPResponse response;
+    response.set_status_code(StatusCode::SERVICE_UNAVAILABLE);
+    response.set_text_response(message);
+    return response;
+}
+
+HTTPResponse HTTPResponse::from_serialized(std::shared_ptr<const std::string> serialized) {
+    HTTPResponse response;
+    // "HTTP/1.1 200 OK": keep the status code readable for callers
+    if (serialized->length() >= 12) {
+        response.set_status_code(static_cast<StatusCode>(std::atoi(serialized->c_str() + 9)));
+    }
+    response.serialized_ = std::move(serialized);
+    return response;
+}
+
 std::string HTTPResponse::status_code_to_string(StatusCode code) const {
     return std::to_string(static_cast<int>(code));
 }
@@ -96,8 +180,13 @@ std::string HTTPResponse::get_status_message(StatusCode code) const {
         case StatusCode::BAD_REQUEST: return "Bad Request";
         case StatusCode::NOT_FOUND: return "Not Found";
         case StatusCode::METHOD_NOT_ALLOWED: return "Method Not Allowed";
+        case StatusCode::CONFLICT: return "Conflict";
+        case StatusCode::LENGTH_REQUIRED: return "Length Required";
+        case StatusCode::PAYLOAD_TOO_LARGE: return "Payload Too Large";
         case StatusCode::INTERNAL_SERVER_ERROR: return "Internal Server Error";
         case StatusCode::NOT_IMPLEMENTED: return "Not Implemented";
+        case StatusCode::BAD_GATEWAY: return "Bad Gateway";
+        case StatusCode::SERVICE_UNAVAILABLE: return "Service Unavailable";
         default: return "Unknown";
     }
 } 
\ No newline at end of file
@@ -2,15 +2,29 @@
 #include "http_request.h"
 #include "http_response.h"
 #include "route_handler.h"
+#include "multipart_parser.h"
+#include "tls_context.h"
+#include "http2_connection.h"
+#include "trace.h"
 #include <iostream>
+#include <algorithm>
+#include <cctype>
 #include <cstring>
+#include <cstdlib>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <errno.h>
+#include <sstream>
 
 HTTPServer::HTTPServer(int port, int max_connections)
-    : port_(port), max_connections_(max_connections), server_socket_(-1), running_(false) {
+    : port_(port), max_connections_(max_connections), handoff_socket_(-1), predecessor_socket_(-1),
+      started_(false), shard_per_core_(false), running_(false), max_body_size_(16 * 1024 * 1024),
+      shutdown_timeout_(std::chrono::seconds(10)) {
     route_handler_ = std::make_unique<RouteHandler>();
 }
 
@@ -19,19 +33,133 @@ HTTPServer::~HTTPServer() {
 }
 
 bool HTTPServer::start() {
+    // Cores to run on: the configured ones this process may use, or all it may use
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    std::vector<int> cpus;
+    for (int cpu : cpus_) {
+        if (!have_allowed || CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        } else {
+            std::cerr << "CPU " << cpu << " is not available to this process, skipping it" << std::endl;
+        }
+    }
+    if (!cpus_.empty() && cpus.empty()) {
+        std::cerr << "None of the configured CPUs are available to this process" << std::endl;
+        return false;
+    }
+    if (cpus.empty() && shard_per_core_ && have_allowed) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        }
+    }
+    size_t num_shards = shard_per_core_ && !cpus.empty() ? cpus.size() : 1;
+    cpus_ = cpus;   // Worker threads pin themselves to the same set
+    
+    // Take over the listeners from a running predecessor if there is one
+    if (!handoff_path_.empty()) {
+        listeners_ = receive_listeners();
+        if (!listeners_.empty()) {
+            std::cout << "Took over " << listeners_.size() << " listening socket(s) from previous server via "
+                      << handoff_path_ << std::endl;
+        }
+    }
+    
+    // One SO_REUSEPORT listener per shard lets the kernel spread connections across cores
+    bool inherited = !listeners_.empty();
+    while (listeners_.size() < num_shards) {
+        int listener = open_listener(shard_per_core_);
+        if (listener < 0) {
+            // An inherited listener without SO_REUSEPORT can't be joined; serve what we have
+            if (inherited) break;
+            close_listeners();
+            return false;
+        }
+        listeners_.push_back(listener);
+    }
+    num_shards = std::min(num_shards, listeners_.size());
+    
+    // Set sockets to non-blocking mode
+    for (int listener : listeners_) {
+        int flags = fcntl(listener, F_GETFL, 0);
+        fcntl(listener, F_SETFL, flags | O_NONBLOCK);
+    }
+    
+    // Closing the predecessor connection unconfirmed tells it to keep serving
+    if (!handoff_path_.empty() && !open_handoff_socket()) {
+        close_listeners();
+        if (predecessor_socket_ >= 0) {
+            close(predecessor_socket_);
+            predecessor_socket_ = -1;
+        }
+        return false;
+    }
+    
+    started_ = true;
+    running_ = true;
+    std::cout << "HTTP Server started on port " << port_;
+    if (num_shards > 1) {
+        std::cout << " (" << num_shards << " per-core shards)";
+    }
+    std::cout << std::endl;
+    
+    // Start worker threads
+    int num_threads = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+    if (num_threads == 0) num_threads = 4;
+    
+    for (int i = 0; i < num_threads; ++i) {
+        worker_threads_.emplace_back(&HTTPServer::worker_thread, this);
+    }
+    
+    // Accept connections in the background so the caller can wait for a shutdown signal.
+    // Sharded: one acceptor pinned per core, and its client threads inherit that pinning.
+    // Otherwise a single acceptor restricted to the configured cores.
+    std::vector<std::vector<int>> shard_listeners(num_shards);
+    for (size_t i = 0; i < listeners_.size(); ++i) {
+        shard_listeners[i % num_shards].push_back(listeners_[i]);
+    }
+    for (size_t i = 0; i < num_shards; ++i) {
+        std::vector<int> shard_cpus = num_shards > 1 ? std::vector<int>{cpus[i]} : cpus;
+        acceptor_threads_.emplace_back(&HTTPServer::accept_connections, this, shard_listeners[i], shard_cpus);
+    }
+    
+    if (handoff_socket_ >= 0) {
+        handoff_thread_ = std::thread(&HTTPServer::handoff_loop, this);
+    }
+    
+    // Serving: let the predecessor stop. If it gave up waiting it still owns the
+    // listeners, and two servers would be left running, so back out instead.
+    if (predecessor_socket_ >= 0) {
+        char ack = 'A';
+        bool confirmed = send(predecessor_socket_, &ack, 1, MSG_NOSIGNAL) == 1;
+        close(predecessor_socket_);
+        predecessor_socket_ = -1;
+        if (!confirmed) {
+            std::cerr << "Previous server gave up on the handoff, stopping" << std::endl;
+            stop();
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+int HTTPServer::open_listener(bool reuse_port) {
     // Create socket
-    server_socket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket_ < 0) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) {
         std::cerr << "Error creating socket: " << strerror(errno) << std::endl;
-        return false;
+        return -1;
     }
     
     // Set socket options
     int opt = 1;
-    if (setsockopt(server_socket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        (reuse_port && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)) {
         std::cerr << "Error setting socket options: " << strerror(errno) << std::endl;
-        close(server_socket_);
-        return false;
+        close(listener);
+        return -1;
     }
     
     // Bind socket
@@ -40,51 +168,51 @@ bool HTTPServer::start() {
     server_addr_.sin_addr.s_addr = INADDR_ANY;
     server_addr_.sin_port = htons(port_);
     
-    if (bind(server_socket_, (struct sockaddr*)&server_addr_, sizeof(server_addr_)) < 0) {
+    if (bind(listener, (struct sockaddr*)&server_addr_, sizeof(server_addr_)) < 0) {
         std::cerr << "Error binding socket: " << strerror(errno) << std::endl;
-        close(server_socket_);
-        return false;
+        close(listener);
+        return -1;
     }
     
     // Listen for connections
-    if (listen(server_socket_, max_connections_) < 0) {
+    if (listen(listener, max_connections_) < 0) {
         std::cerr << "Error listening on socket: " << strerror(errno) << std::endl;
-        close(server_socket_);
-        return false;
+        close(listener);
+        return -1;
     }
     
-    // Set socket to non-blocking mode
-    int flags = fcntl(server_socket_, F_GETFL, 0);
-    fcntl(server_socket_, F_SETFL, flags | O_NONBLOCK);
-    
-    running_ = true;
-    std::cout << "HTTP Server started on port " << port_ << std::endl;
-    
-    // Start worker threads
-    int num_threads = std::thread::hardware_concurrency();
-    if (num_threads == 0) num_threads = 4;
-    
-    for (int i = 0; i < num_threads; ++i) {
-        worker_threads_.emplace_back(&HTTPServer::worker_thread, this);
+    return listener;
+}
+
+void HTTPServer::close_listeners() {
+    for (int listener : listeners_) {
+        close(listener);
     }
-    
-    // Start accepting connections in main thread
-    accept_connections();
-    
-    return true;
+    listeners_.clear();
 }
 
 void HTTPServer::stop() {
-    if (!running_) return;
+    if (!started_) return;
+    started_ = false;
     
+    // Stop accepting; a successor may still own the listener after a handoff
     running_ = false;
-    
-    // Close server socket
-    if (server_socket_ >= 0) {
-        close(server_socket_);
-        server_socket_ = -1;
+    for (auto& thread : acceptor_threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    acceptor_threads_.clear();
+    if (handoff_thread_.joinable()) {
+        handoff_thread_.join();
     }
     
+    // Close server sockets
+    close_listeners();
+    
+    // Let in-flight requests finish before tearing down the route handler
+    drain_connections();
+    
     // Wait for worker threads to finish
     for (auto& thread : worker_threads_) {
         if (thread.joinable()) {
@@ -96,75 +224,499 @@ void HTTPServer::stop() {
     std::cout << "HTTP Server stopped" << std::endl;
 }
 
-void HTTPServer::accept_connections() {
+void HTTPServer::drain_connections() {
+    std::unique_lock<std::mutex> lock(clients_mutex_);
+    if (active_clients_.empty()) return;
+    
+    std::cout << "Draining " << active_clients_.size() << " in-flight connection(s)..." << std::endl;
+    auto deadline = std::chrono::steady_clock::now() + shutdown_timeout_;
+    if (clients_cv_.wait_until(lock, deadline, [this] { return active_clients_.empty(); })) {
+        return;
+    }
+    
+    // Deadline passed: unblock stragglers so their threads can exit
+    std::cerr << "Shutdown timeout reached, closing " << active_clients_.size()
+              << " connection(s)" << std::endl;
+    for (int client_socket : active_clients_) {
+        shutdown(client_socket, SHUT_RDWR);
+    }
+    clients_cv_.wait(lock, [this] { return active_clients_.empty(); });
+}
+
+void HTTPServer::accept_connections(std::vector<int> listeners, std::vector<int> cpus) {
+    // Threads inherit the creator's affinity, so pinning here pins every client thread too
+    // (and first-touch allocation keeps their memory on the local NUMA node)
+    pin_current_thread(cpus);
+    
+    std::vector<struct pollfd> fds;
+    for (int listener : listeners) {
+        fds.push_back({listener, POLLIN, 0});
+    }
+    
     while (running_) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        int client_socket = accept(server_socket_, (struct sockaddr*)&client_addr, &client_len);
+        // Wake up periodically to notice shutdown
+        if (poll(fds.data(), fds.size(), 10) <= 0) {
+            continue;
+        }
         
-        if (client_socket < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // No pending connections, sleep briefly
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        for (const auto& pfd : fds) {
+            if (!(pfd.revents & POLLIN)) continue;
+            
+            struct sockaddr_in client_addr;
+            socklen_t client_len = sizeof(client_addr);
+            
+            uint64_t accepted_at = TRACE_NOW();
+            int client_socket = accept(pfd.fd, (struct sockaddr*)&client_addr, &client_len);
+            
+            if (client_socket < 0) {
+                // Another process sharing the listener (during a handoff) may have taken it
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    std::cerr << "Error accepting connection: " << strerror(errno) << std::endl;
+                }
                 continue;
             }
-            std::cerr << "Error accepting connection: " << strerror(errno) << std::endl;
-            continue;
+            
+            // Track the connection before its thread starts so stop() can wait for it
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex_);
+                active_clients_.insert(client_socket);
+            }
+            
+            // Handle client in a new thread
+            std::thread client_thread(&HTTPServer::handle_client, this, client_socket, accepted_at);
+            client_thread.detach();
         }
-        
-        // Handle client in a new thread
-        std::thread client_thread(&HTTPServer::handle_client, this, client_socket);
-        client_thread.detach();
     }
 }
 
-void HTTPServer::handle_client(int client_socket) {
-    char buffer[4096];
-    std::string request_data;
+void HTTPServer::pin_current_thread(const std::vector<int>& cpus) {
+    if (cpus.empty()) return;
     
-    // Set client socket timeout
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &cpu_set);
+    }
+    
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (rc != 0) {
+        std::cerr << "Error setting CPU affinity: " << strerror(rc) << std::endl;
+    }
+}
+
+std::vector<int> HTTPServer::parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+    
+    // A CPU number and nothing else up to the end (strtol alone would take " 1", "+1", "1x")
+    auto parse_cpu = [](const std::string& text, int& cpu) {
+        if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+            return false;
+        }
+        char* end = nullptr;
+        errno = 0;
+        long value = std::strtol(text.c_str(), &end, 10);
+        if (*end != '\0' || errno == ERANGE || value >= CPU_SETSIZE) {
+            return false;
+        }
+        cpu = static_cast<int>(value);
+        return true;
+    };
+    
+    // "0-3,6" -> {0, 1, 2, 3, 6}
+    if (list.empty() || list.back() == ',') {
+        return {};
+    }
+    while (std::getline(stream, range, ',')) {
+        size_t dash_pos = range.find('-');
+        int first = 0;
+        int last = 0;
+        if (!parse_cpu(range.substr(0, dash_pos), first)) {
+            return {};
+        }
+        if (dash_pos == std::string::npos) {
+            last = first;
+        } else if (!parse_cpu(range.substr(dash_pos + 1), last) || last < first) {
+            return {};
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    
+    return cpus;
+}
+
+void HTTPServer::handle_client(int client_socket, uint64_t accepted_at) {
+    TRACE_BEGIN_REQUEST();
+    TRACE_SINCE(ACCEPT, accepted_at);
+    
+    // Set client socket timeout (also bounds the TLS handshake)
     struct timeval timeout;
     timeout.tv_sec = 5;
     timeout.tv_usec = 0;
     setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     
-    // Read request data
-    ssize_t bytes_read;
-    while ((bytes_read = recv(client_socket, buffer, sizeof(buffer) - 1, 0)) > 0) {
-        buffer[bytes_read] = '\0';
-        request_data += buffer;
-        
-        // Check if we have received the complete request
-        if (request_data.find("\r\n\r\n") != std::string::npos) {
-            break;
+    {
+        TRACE_SCOPE(CONNECTION);
+        std::unique_ptr<Connection> connection;
+        if (tls_context_) {
+            TRACE_SCOPE(HANDSHAKE);
+            connection = tls_context_->accept(client_socket);
+        } else {
+            connection = std::make_unique<Connection>(client_socket);
+        }
+        if (connection && connection->get_alpn_protocol() == "h2") {
+            serve_http2(*connection, "");
+        } else if (connection) {
+            serve_request(*connection);
+        }
+    }
+    
+    // Untrack before closing so the descriptor can't be reused while still in the set.
+    // Notify under the lock: once it is released, stop() may return and destroy the server.
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    active_clients_.erase(client_socket);
+    close(client_socket);
+    clients_cv_.notify_all();
+}
+
+void HTTPServer::serve_request(Connection& connection) {
+    char buffer[16384];
+    std::string request_data;
+    
+    // Read the request line and headers (binary-safe: the body may follow in the same segment)
+    size_t header_end = std::string::npos;
+    ssize_t bytes_read = 0;
+    {
+        TRACE_SCOPE(RECV);
+        while (header_end == std::string::npos &&
+               (bytes_read = connection.read(buffer, sizeof(buffer))) > 0) {
+            size_t search_from = request_data.length() >= 3 ? request_data.length() - 3 : 0;
+            request_data.append(buffer, bytes_read);
+            header_end = request_data.find("\r\n\r\n", search_from);
+            
+            if (header_end == std::string::npos && request_data.length() > kMaxHeaderSize) {
+                send_response(connection, HTTPResponse::bad_request("Request header too large"));
+                return;
+            }
         }
     }
     
     if (bytes_read < 0) {
         std::cerr << "Error reading from client: " << strerror(errno) << std::endl;
-        close(client_socket);
         return;
     }
     
+    // h2c with prior knowledge: the client preface parses as a head of its own
+    if (header_end != std::string::npos &&
+        request_data.compare(0, header_end + 4, Http2Connection::kPreface, Http2Connection::kPrefaceHeadLength) == 0) {
+        serve_http2(connection, request_data);
+        return;
+    }
+    
+    std::string body;
+    if (header_end != std::string::npos) {
+        body = request_data.substr(header_end + 4);
+        request_data.resize(header_end + 4);
+    }
+    
     // Parse and handle request
     HTTPRequest request;
     HTTPResponse response;
     
-    if (request.parse(request_data)) {
+    if (!request.parse(request_data)) {
+        send_response(connection, HTTPResponse::bad_request("Invalid HTTP request"));
+        return;
+    }
+    
+    // The body is framed by Content-Length alone: chunked bodies aren't supported, and a
+    // request without a length has no body (POST and PUT must send one)
+    size_t content_length = 0;
+    if (request.has_header("Transfer-Encoding")) {
+        send_response(connection, HTTPResponse::not_implemented("Transfer-Encoding is not supported"));
+        return;
+    }
+    if (!request.get_content_length(content_length)) {
+        send_response(connection, HTTPResponse::bad_request("Invalid Content-Length"));
+        return;
+    }
+    if (!request.has_header("Content-Length") && (request.get_method() == HTTPRequest::Method::POST ||
+                                                  request.get_method() == HTTPRequest::Method::PUT)) {
+        send_response(connection, HTTPResponse::length_required());
+        return;
+    }
+    
+    if (const auto* factory = route_handler_->find_multipart_route(request)) {
+        // Uploads are streamed through the parser and never held in memory
+        response = receive_multipart(connection, request, *factory, body, content_length);
+    } else if (content_length > max_body_size_) {
+        response = HTTPResponse::payload_too_large();
+    } else {
+        send_continue(connection, request, body, content_length);
+        {
+            TRACE_SCOPE(RECV);
+            while (body.length() < content_length) {
+                bytes_read = connection.read(buffer, sizeof(buffer));
+                if (bytes_read <= 0) {
+                    std::cerr << "Error reading request body: "
+                              << (bytes_read < 0 ? strerror(errno) : "connection closed") << std::endl;
+                    return;
+                }
+                body.append(buffer, bytes_read);
+            }
+        }
+        std::string received = body.substr(content_length);
+        body.resize(content_length);
+        request.set_body(std::move(body));
+        
+        // h2c upgrade: answer this request as stream 1 of an HTTP/2 connection
+        if (!connection.is_tls() && Http2Connection::is_upgrade_request(request)) {
+            Http2Connection http2(connection, *route_handler_, running_, max_body_size_);
+            if (http2.upgrade(request)) {
+                static const char kSwitching[] = "HTTP/1.1 101 Switching Protocols\r\n"
+                                                 "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+                if (connection.write_all(kSwitching, sizeof(kSwitching) - 1)) {
+                    http2.serve(received);
+                }
+                return;
+            }
+        }
+        
         response = route_handler_->handle_request(request);
+    }
+    
+    send_response(connection, response);
+}
+
+void HTTPServer::serve_http2(Connection& connection, const std::string& received) {
+    Http2Connection http2(connection, *route_handler_, running_, max_body_size_);
+    http2.serve(received);
+}
+
+HTTPResponse HTTPServer::receive_multipart(Connection& connection, const HTTPRequest& request,
+                                           const RouteHandler::MultipartFactory& factory,
+                                           const std::string& initial_body, size_t content_length) {
+    TRACE_SCOPE(UPLOAD);
+    std::string boundary = MultipartParser::boundary_from_content_type(request.get_header("Content-Type"));
+    if (boundary.empty()) {
+        return HTTPResponse::bad_request("Expected multipart/form-data with a boundary");
+    }
+    
+    std::unique_ptr<MultipartHandler> handler = factory(request);
+    MultipartParser parser(boundary, *handler);
+    
+    size_t received = std::min(initial_body.length(), content_length);
+    bool ok = parser.feed(initial_body.data(), received);
+    
+    send_continue(connection, request, initial_body, content_length);
+    char buffer[65536];
+    while (ok && received < content_length) {
+        ssize_t bytes_read = connection.read(buffer, std::min(sizeof(buffer), content_length - received));
+        if (bytes_read <= 0) {
+            break;
+        }
+        received += bytes_read;
+        ok = parser.feed(buffer, bytes_read);
+    }
+    
+    return handler->finish(ok && parser.is_complete());
+}
+
+void HTTPServer::send_continue(Connection& connection, const HTTPRequest& request,
+                               const std::string& body, size_t content_length) {
+    // Clients sending "Expect: 100-continue" hold the body back until told to go ahead
+    if (body.length() < content_length && request.get_header("Expect") == "100-continue") {
+        static const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        connection.write_all(kContinue, sizeof(kContinue) - 1);
+    }
+}
+
+void HTTPServer::send_response(Connection& connection, const HTTPResponse& response) {
+    TRACE_SCOPE(SEND);
+    
+    // File bodies go out with sendfile() after the head
+    if (response.has_file_body()) {
+        std::string head = response.head_to_string();
+        if (connection.write_all(head.data(), head.length())) {
+            connection.send_file(response.get_file_fd(), response.get_file_size());
+        }
+        return;
+    }
+    
+    auto response_data = response.serialize();
+    connection.write_all(response_data->data(), response_data->length());
+}
+
+bool HTTPServer::set_tls(const std::string& cert_file, const std::string& key_file) {
+    auto context = std::make_unique<TlsContext>();
+    if (!context->load(cert_file, key_file)) {
+        return false;
+    }
+    context->set_alpn_protocols({"h2", "http/1.1"});
+    tls_context_ = std::move(context);
+    return true;
+}
+
+std::vector<int> HTTPServer::receive_listeners() {
+    std::vector<int> listeners;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return listeners;
+    }
+    
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, handoff_path_.c_str(), sizeof(addr.sun_path) - 1);
+    
+    // No predecessor listening on the handoff path: bind a fresh listener instead
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return listeners;
+    }
+    
+    char byte;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxHandoffListeners)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    
+    if (recvmsg(sock, &msg, 0) > 0) {
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            listeners.resize(count);
+            memcpy(listeners.data(), CMSG_DATA(cmsg), sizeof(int) * count);
+        }
     } else {
-        response = HTTPResponse::bad_request("Invalid HTTP request");
+        std::cerr << "Error receiving listeners from " << handoff_path_ << ": " << strerror(errno) << std::endl;
     }
     
-    // Send response
-    std::string response_str = response.to_string();
-    send(client_socket, response_str.c_str(), response_str.length(), 0);
+    // Kept open to confirm startup once the listeners are being served
+    if (listeners.empty()) {
+        close(sock);
+    } else {
+        predecessor_socket_ = sock;
+    }
+    return listeners;
+}
+
+bool HTTPServer::open_handoff_socket() {
+    handoff_socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (handoff_socket_ < 0) {
+        std::cerr << "Error creating handoff socket: " << strerror(errno) << std::endl;
+        return false;
+    }
     
-    close(client_socket);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, handoff_path_.c_str(), sizeof(addr.sun_path) - 1);
+    
+    // Replace the predecessor's endpoint; it has already handed us the listener
+    unlink(handoff_path_.c_str());
+    if (bind(handoff_socket_, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(handoff_socket_, 1) < 0) {
+        std::cerr << "Error binding handoff socket " << handoff_path_ << ": " << strerror(errno) << std::endl;
+        close(handoff_socket_);
+        handoff_socket_ = -1;
+        return false;
+    }
+    
+    int flags = fcntl(handoff_socket_, F_GETFL, 0);
+    fcntl(handoff_socket_, F_SETFL, flags | O_NONBLOCK);
+    return true;
+}
+
+void HTTPServer::handoff_loop() {
+    bool handed_off = false;
+    
+    while (running_ && !handed_off) {
+        int successor = accept(handoff_socket_, nullptr, nullptr);
+        if (successor < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        
+        char byte = 'L';
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+        
+        size_t count = std::min(listeners_.size(), kMaxHandoffListeners);
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxHandoffListeners)];
+        memset(control, 0, sizeof(control));
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), listeners_.data(), sizeof(int) * count);
+        
+        if (sendmsg(successor, &msg, MSG_NOSIGNAL) < 0) {
+            std::cerr << "Error handing off listeners: " << strerror(errno) << std::endl;
+        } else if (wait_for_handoff_ack(successor)) {
+            std::cout << "Listeners handed off to new server, draining..." << std::endl;
+            handed_off = true;
+        } else if (running_) {
+            // The successor may have replaced our endpoint before failing: take it back
+            std::cerr << "New server did not confirm startup, still serving" << std::endl;
+            close(handoff_socket_);
+            if (!open_handoff_socket()) {
+                close(successor);
+                return;
+            }
+        }
+        close(successor);
+    }
+    
+    // The successor re-creates the endpoint at the same path, so only close ours
+    close(handoff_socket_);
+    handoff_socket_ = -1;
+    
+    // Stop accepting; the owner sees is_running() == false and calls stop() to drain
+    if (handed_off) {
+        running_ = false;
+    }
+}
+
+bool HTTPServer::wait_for_handoff_ack(int successor) {
+    auto deadline = std::chrono::steady_clock::now() + kHandoffAckTimeout;
+    
+    // Poll in short steps so stop() isn't held up by a slow successor
+    while (running_ && std::chrono::steady_clock::now() < deadline) {
+        struct pollfd pfd = {successor, POLLIN, 0};
+        int ready = poll(&pfd, 1, 100);
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+        if (ready > 0) {
+            // One byte once it is serving; a close without it means startup failed
+            char ack = 0;
+            return recv(successor, &ack, 1, 0) == 1 && ack == 'A';
+        }
+    }
+    return false;
 }
 
 void HTTPServer::worker_thread() {
+    pin_current_thread(cpus_);
+    
     while (running_) {
         // Worker threads can handle additional tasks if needed
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -0,0 +1,218 @@
+#include "json_writer.h"
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Escape sequence for a character that can't appear raw in a JSON string
+void append_escaped(std::string& out, unsigned char c) {
+    static const char hex[] = "0123456789abcdef";
+    switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default: {
+            char unicode[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            out.append(unicode, sizeof(unicode));
+        }
+    }
+}
+
+inline bool needs_attention(unsigned char c) {
+    return c < 0x20 || c == '"' || c == '\\' || c >= 0x80;
+}
+
+// Length of the well-formed UTF-8 sequence at data, or 0 if it is malformed
+size_t utf8_sequence_length(const unsigned char* data, size_t remaining) {
+    unsigned char lead = data[0];
+    size_t length;
+    unsigned char min_second = 0x80, max_second = 0xbf;
+    
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        length = 2;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+        length = 3;
+        if (lead == 0xe0) min_second = 0xa0;          // Overlong
+        if (lead == 0xed) max_second = 0x9f;          // Surrogates
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+        length = 4;
+        if (lead == 0xf0) min_second = 0x90;          // Overlong
+        if (lead == 0xf4) max_second = 0x8f;          // Above U+10FFFF
+    } else {
+        return 0;
+    }
+    
+    if (remaining < length || data[1] < min_second || data[1] > max_second) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; ++i) {
+        if ((data[i] & 0xc0) != 0x80) return 0;
+    }
+    return length;
+}
+
+// Write the character (or UTF-8 sequence) at data[i]; returns how many bytes were consumed
+size_t append_special(std::string& out, const char* data, size_t i, size_t length) {
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    if (c < 0x80) {
+        append_escaped(out, c);
+        return 1;
+    }
+    
+    size_t sequence = utf8_sequence_length(reinterpret_cast<const unsigned char*>(data + i), length - i);
+    if (sequence == 0) {
+        // Invalid UTF-8 would make the whole document invalid; substitute U+FFFD
+        out += "\\ufffd";
+        return 1;
+    }
+    out.append(data + i, sequence);
+    return sequence;
+}
+
+}
+
+JsonWriter::JsonWriter(std::string& out)
+    : out_(out), depth_(0), has_items_(0), after_key_(false) {
+}
+
+JsonWriter& JsonWriter::begin_object() {
+    open('{');
+    return *this;
+}
+
+JsonWriter& JsonWriter::end_object() {
+    close('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::begin_array() {
+    open('[');
+    return *this;
+}
+
+JsonWriter& JsonWriter::end_array() {
+    close(']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view name) {
+    before_value();
+    write_string(out_, name);
+    out_ += ':';
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(std::string_view text) {
+    before_value();
+    write_string(out_, text);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+    before_value();
+    out_ += flag ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(double number) {
+    // JSON has no representation for NaN or infinity
+    if (!std::isfinite(number)) {
+        return null_value();
+    }
+    before_value();
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), number);
+    out_.append(digits, result.ptr - digits);
+    return *this;
+}
+
+JsonWriter& JsonWriter::null_value() {
+    before_value();
+    out_ += "null";
+    return *this;
+}
+
+void JsonWriter::before_value() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ > 0 && depth_ <= kMaxDepth) {
+        uint64_t bit = uint64_t(1) << (depth_ - 1);
+        if (has_items_ & bit) {
+            out_ += ',';
+        }
+        has_items_ |= bit;
+    }
+}
+
+void JsonWriter::open(char bracket) {
+    before_value();
+    out_ += bracket;
+    ++depth_;
+    if (depth_ <= kMaxDepth) {
+        has_items_ &= ~(uint64_t(1) << (depth_ - 1));
+    }
+}
+
+void JsonWriter::close(char bracket) {
+    out_ += bracket;
+    --depth_;
+}
+
+void JsonWriter::write_string(std::string& out, std::string_view text) {
+    out.reserve(out.length() + text.length() + 2);
+    out += '"';
+    
+    const char* data = text.data();
+    size_t length = text.length();
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    // Copy 16-byte blocks of plain ASCII in one go; stop at the first byte that needs
+    // escaping or UTF-8 validation (the high bit comes straight from movemask)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1f);
+    
+    while (i + 16 <= length) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(block, control_max), control_max);
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash));
+        int mask = _mm_movemask_epi8(_mm_or_si128(control, special)) | _mm_movemask_epi8(block);
+        
+        if (mask == 0) {
+            out.append(data + i, 16);
+            i += 16;
+            continue;
+        }
+        
+        int offset = __builtin_ctz(mask);
+        out.append(data + i, offset);
+        i += offset;
+        i += append_special(out, data, i, length);
+    }
+#endif
+    
+    // Tail (or everything without SSE2): copy runs between escapes
+    size_t run_start = i;
+    while (i < length) {
+        if (!needs_attention(static_cast<unsigned char>(data[i]))) {
+            ++i;
+            continue;
+        }
+        out.append(data + run_start, i - run_start);
+        i += append_special(out, data, i, length);
+        run_start = i;
+    }
+    out.append(data + run_start, length - run_start);
+    
+    out += '"';
+}
@@ -1,4 +1,7 @@
 #include "http_server.h"
+#include "route_handler.h"
+#include "upstream_pool.h"
+#include "trace.h"
 #include <iostream>
 #include <csignal>
 #include <cstdlib>
@@ -12,6 +15,17 @@ void signal_handler(int signal) {
 
 int main(int argc, char* argv[]) {
     int port = 8080;
+    int shutdown_timeout = 10;
+    std::string handoff_path;
+    std::vector<std::string> proxy_specs;
+    std::vector<int> cpus;
+    bool shard_per_core = false;
+    std::string upload_dir;
+    std::string tls_cert;
+    std::string tls_key;
+    uint32_t trace_sample = 0;
+    std::string trace_file;
+    UpstreamPool::Balancing balancing = UpstreamPool::Balancing::ROUND_ROBIN;
     
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -20,10 +34,77 @@ int main(int argc, char* argv[]) {
             if (i + 1 < argc) {
                 port = std::atoi(argv[++i]);
             }
+        } else if (arg == "--shutdown-timeout") {
+            if (i + 1 < argc) {
+                shutdown_timeout = std::atoi(argv[++i]);
+            }
+        } else if (arg == "--handoff") {
+            if (i + 1 < argc) {
+                handoff_path = argv[++i];
+            }
+        } else if (arg == "--proxy") {
+            if (i + 1 < argc) {
+                proxy_specs.push_back(argv[++i]);
+            }
+        } else if (arg == "--balance") {
+            if (i + 1 < argc) {
+                std::string mode = argv[++i];
+                if (mode == "least-conn") {
+                    balancing = UpstreamPool::Balancing::LEAST_CONNECTIONS;
+                } else if (mode != "round-robin") {
+                    std::cerr << "Unknown balancing mode: " << mode << std::endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--cpus") {
+            if (i + 1 < argc) {
+                cpus = HTTPServer::parse_cpu_list(argv[++i]);
+                if (cpus.empty()) {
+                    std::cerr << "Invalid CPU list: " << argv[i] << std::endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--shard-per-core") {
+            shard_per_core = true;
+        } else if (arg == "--upload-dir") {
+            if (i + 1 < argc) {
+                upload_dir = argv[++i];
+            }
+        } else if (arg == "--tls-cert") {
+            if (i + 1 < argc) {
+                tls_cert = argv[++i];
+            }
+        } else if (arg == "--tls-key") {
+            if (i + 1 < argc) {
+                tls_key = argv[++i];
+            }
+        } else if (arg == "--trace-sample") {
+            if (i + 1 < argc) {
+                trace_sample = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            }
+        } else if (arg == "--trace-file") {
+            if (i + 1 < argc) {
+                trace_file = argv[++i];
+            }
         } else if (arg == "--help" || arg == "-h") {
             std::cout << "Usage: " << argv[0] << " [options]\n"
                       << "Options:\n"
                       << "  -p, --port PORT    Port to listen on (default: 8080)\n"
+                      << "  --shutdown-timeout SECONDS\n"
+                      << "                     Time in-flight requests get to finish on shutdown (default: 10)\n"
+                      << "  --handoff PATH     Unix socket for zero-downtime restarts: take over the\n"
+                      << "                     listener from the server at PATH, then serve it to the next one\n"
+                      << "  --proxy PATH=HOST:PORT[,HOST:PORT...]\n"
+                      << "                     Forward requests under PATH (e.g. /api/*) to upstreams\n"
+                      << "  --balance MODE     Upstream balancing: round-robin (default) or least-conn\n"
+                      << "  --cpus LIST        Run only on these cores, e.g. 0-3,6\n"
+                      << "  --shard-per-core   One pinned listener/acceptor per core (SO_REUSEPORT)\n"
+                      << "  --upload-dir DIR   Accept multipart uploads on POST /upload, saving files to DIR\n"
+                      << "  --tls-cert FILE    Serve HTTPS with this PEM certificate chain\n"
+                      << "  --tls-key FILE     Private key for --tls-cert\n"
+                      << "  --trace-sample N   Trace one request in N (builds with tracing only);\n"
+                      << "                     traces are served on GET /debug/trace\n"
+                      << "  --trace-file FILE  Also write the trace to FILE on shutdown\n"
                       << "  -h, --help         Show this help message\n"
                       << std::endl;
             return 0;
@@ -34,25 +115,69 @@ int main(int argc, char* argv[]) {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
+    // TLS writes go through write(), which would raise SIGPIPE on a reset connection
+    signal(SIGPIPE, SIG_IGN);
+    
     std::cout << "🚀 Starting C++ HTTP Server on port " << port << std::endl;
     std::cout << "Press Ctrl+C to stop the server\n" << std::endl;
     
     // Create and start server
     HTTPServer server(port);
+    server.set_shutdown_timeout(std::chrono::seconds(shutdown_timeout));
+    server.set_cpus(cpus);
+    server.set_shard_per_core(shard_per_core);
+    
+    if (!tls_cert.empty() || !tls_key.empty()) {
+        if (!server.set_tls(tls_cert, tls_key.empty() ? tls_cert : tls_key)) {
+            std::cerr << "Failed to set up TLS!" << std::endl;
+            return 1;
+        }
+    }
+    if (!handoff_path.empty()) {
+        server.set_handoff_path(handoff_path);
+    }
+    
+    if (trace_sample > 0 || !trace_file.empty()) {
+        if (!Tracer::is_supported()) {
+            std::cerr << "Tracing requested, but this build has no tracing support!" << std::endl;
+            return 1;
+        }
+        Tracer::set_sample_rate(trace_sample > 0 ? trace_sample : 1);
+    }
+    
+    if (!upload_dir.empty()) {
+        server.get_route_handler().register_multipart_route("/upload", [upload_dir](const HTTPRequest&) {
+            return std::make_unique<MultipartFileSaver>(upload_dir);
+        });
+    }
+    
+    for (const auto& spec : proxy_specs) {
+        size_t equal_pos = spec.find('=');
+        auto upstreams = std::make_shared<UpstreamPool>(balancing);
+        if (equal_pos == std::string::npos || !upstreams->add_upstreams(spec.substr(equal_pos + 1))) {
+            std::cerr << "Invalid --proxy value: " << spec << std::endl;
+            return 1;
+        }
+        server.get_route_handler().register_proxy_route(spec.substr(0, equal_pos), upstreams);
+    }
     
     if (!server.start()) {
         std::cerr << "Failed to start server!" << std::endl;
         return 1;
     }
     
-    // Wait for shutdown signal
+    // Wait for shutdown signal (or for a successor to take over the listener)
     while (running && server.is_running()) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
     
-    // Stop server
+    // Stop accepting and drain in-flight requests
     server.stop();
     
+    if (!trace_file.empty() && !Tracer::write_json(trace_file)) {
+        std::cerr << "Failed to write trace to " << trace_file << std::endl;
+    }
+    
     std::cout << "Server stopped successfully." << std::endl;
     return 0;
 } 
\ No newline at end of file
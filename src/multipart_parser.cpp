@@ -0,0 +1,380 @@
+#include "multipart_parser.h"
+#include "json_writer.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <errno.h>
+#include <unistd.h>
+
+namespace {
+
+std::string to_lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    return text;
+}
+
+void trim(std::string& text) {
+    text.erase(0, text.find_first_not_of(" \t"));
+    text.erase(text.find_last_not_of(" \t") + 1);
+}
+
+}
+
+std::string MultipartHandler::header_param(const std::string& value, const std::string& param) {
+    std::string lower = to_lower(value);
+    std::string needle = to_lower(param) + "=";
+    
+    size_t pos = 0;
+    while ((pos = lower.find(needle, pos)) != std::string::npos) {
+        // Must be a whole parameter name ("name" must not match inside "filename")
+        if (pos > 0 && lower[pos - 1] != ';' && lower[pos - 1] != ' ' && lower[pos - 1] != '\t') {
+            pos += needle.length();
+            continue;
+        }
+        
+        size_t start = pos + needle.length();
+        if (start < value.length() && value[start] == '"') {
+            std::string result;
+            for (size_t i = start + 1; i < value.length() && value[i] != '"'; ++i) {
+                if (value[i] == '\\' && i + 1 < value.length()) ++i;
+                result += value[i];
+            }
+            return result;
+        }
+        
+        size_t end = value.find(';', start);
+        std::string result = value.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        trim(result);
+        return result;
+    }
+    
+    return "";
+}
+
+MultipartParser::MultipartParser(const std::string& boundary, MultipartHandler& handler)
+    : delimiter_("\r\n--" + boundary), handler_(handler), state_(State::PREAMBLE),
+      buffer_("\r\n") {
+    // The leading CRLF lets the first boundary (at the very start of the body) match
+    // the same delimiter as every later one
+    size_t length = delimiter_.length();
+    for (size_t& skip : skip_) {
+        skip = length;
+    }
+    for (size_t i = 0; i + 1 < length; ++i) {
+        skip_[static_cast<unsigned char>(delimiter_[i])] = length - 1 - i;
+    }
+}
+
+bool MultipartParser::feed(const char* data, size_t length) {
+    if (state_ == State::FAILED) return false;
+    if (state_ == State::DONE) return true;   // Epilogue is ignored
+    
+    buffer_.append(data, length);
+    size_t pos = 0;
+    size_t tail = delimiter_.length() - 1;    // Bytes that may hold a partial delimiter
+    bool progress = true;
+    
+    while (progress && state_ != State::FAILED && state_ != State::DONE) {
+        progress = false;
+        size_t available = buffer_.length() - pos;
+        
+        switch (state_) {
+            case State::PREAMBLE: {
+                size_t found = find_delimiter(buffer_.data() + pos, available);
+                if (found == std::string::npos) {
+                    if (available > tail) pos += available - tail;
+                    break;
+                }
+                pos += found + delimiter_.length();
+                state_ = State::AFTER_BOUNDARY;
+                progress = true;
+                break;
+            }
+            
+            case State::AFTER_BOUNDARY: {
+                if (available < 2) break;
+                if (buffer_.compare(pos, 2, "--") == 0) {
+                    state_ = State::DONE;
+                } else if (buffer_.compare(pos, 2, "\r\n") == 0) {
+                    pos += 2;
+                    state_ = State::HEADERS;
+                    progress = true;
+                } else if (buffer_[pos] == ' ' || buffer_[pos] == '\t') {
+                    // Transport padding after the boundary
+                    ++pos;
+                    progress = true;
+                } else {
+                    state_ = State::FAILED;
+                }
+                break;
+            }
+            
+            case State::HEADERS: {
+                size_t header_length;
+                if (buffer_.compare(pos, 2, "\r\n") == 0) {
+                    header_length = 0;    // Part without headers
+                } else {
+                    size_t end = buffer_.find("\r\n\r\n", pos);
+                    if (end == std::string::npos) {
+                        if (available > kMaxHeaderBlock) state_ = State::FAILED;
+                        break;
+                    }
+                    header_length = end - pos + 2;
+                }
+                
+                if (!parse_part_headers(buffer_.substr(pos, header_length))) {
+                    state_ = State::FAILED;
+                    break;
+                }
+                pos += header_length + 2;
+                state_ = State::BODY;
+                progress = true;
+                break;
+            }
+            
+            case State::BODY: {
+                size_t found = find_delimiter(buffer_.data() + pos, available);
+                if (found == std::string::npos) {
+                    // Everything except a possible partial delimiter belongs to this part
+                    if (available > tail) {
+                        if (!handler_.on_part_data(buffer_.data() + pos, available - tail)) {
+                            state_ = State::FAILED;
+                        }
+                        pos += available - tail;
+                    }
+                    break;
+                }
+                
+                if ((found > 0 && !handler_.on_part_data(buffer_.data() + pos, found)) ||
+                    !handler_.on_part_end()) {
+                    state_ = State::FAILED;
+                    break;
+                }
+                pos += found + delimiter_.length();
+                state_ = State::AFTER_BOUNDARY;
+                progress = true;
+                break;
+            }
+            
+            default:
+                break;
+        }
+    }
+    
+    if (state_ == State::DONE) {
+        buffer_.clear();
+    } else {
+        buffer_.erase(0, pos);
+    }
+    return state_ != State::FAILED;
+}
+
+size_t MultipartParser::find_delimiter(const char* data, size_t length) const {
+    size_t m = delimiter_.length();
+    if (length < m) return std::string::npos;
+    
+    const char* pattern = delimiter_.data();
+    char last = pattern[m - 1];
+    size_t i = 0;
+    
+    while (i <= length - m) {
+        char c = data[i + m - 1];
+        if (c == last && memcmp(data + i, pattern, m - 1) == 0) {
+            return i;
+        }
+        i += skip_[static_cast<unsigned char>(c)];
+    }
+    
+    return std::string::npos;
+}
+
+bool MultipartParser::parse_part_headers(const std::string& block) {
+    MultipartHandler::PartHeaders headers;
+    std::istringstream stream(block);
+    std::string line;
+    
+    while (std::getline(stream, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        
+        size_t colon_pos = line.find(':');
+        if (colon_pos == std::string::npos) return false;
+        
+        // Part header names are case-insensitive; store them lower-cased
+        std::string name = to_lower(line.substr(0, colon_pos));
+        std::string value = line.substr(colon_pos + 1);
+        trim(name);
+        trim(value);
+        headers[name] = value;
+    }
+    
+    return handler_.on_part_begin(headers);
+}
+
+std::string MultipartParser::boundary_from_content_type(const std::string& content_type) {
+    std::string lower = to_lower(content_type);
+    if (lower.compare(0, 19, "multipart/form-data") != 0) {
+        return "";
+    }
+    
+    std::string boundary = MultipartHandler::header_param(content_type, "boundary");
+    // RFC 2046 limits boundaries to 70 characters
+    return boundary.length() <= 70 ? boundary : "";
+}
+
+MultipartFileSaver::MultipartFileSaver(const std::string& directory)
+    : directory_(directory), in_file_(false), parts_(0), fields_size_(0), conflict_(false) {
+}
+
+MultipartFileSaver::~MultipartFileSaver() {
+    // Uploads abandoned without finish() (e.g. a reset HTTP/2 stream) leave nothing behind
+    if (file_.is_open()) {
+        file_.close();
+    }
+    discard_temp_files();
+}
+
+bool MultipartFileSaver::on_part_begin(const PartHeaders& headers) {
+    if (++parts_ > kMaxParts) {
+        return false;
+    }
+    
+    auto disposition = headers.find("content-disposition");
+    std::string value = disposition != headers.end() ? disposition->second : "";
+    field_ = header_param(value, "name");
+    
+    std::string filename = header_param(value, "filename");
+    if (filename.empty()) {
+        in_file_ = false;
+        field_value_.clear();
+        return true;
+    }
+    
+    // Security: keep only the last path component of the client-supplied name
+    size_t slash_pos = filename.find_last_of("/\\");
+    if (slash_pos != std::string::npos) {
+        filename = filename.substr(slash_pos + 1);
+    }
+    if (filename.empty() || filename == "." || filename == "..") {
+        filename = "upload";
+    }
+    
+    // Refuse early rather than receive a file that can't be kept (finish() checks again)
+    if (access((directory_ + "/" + filename).c_str(), F_OK) == 0) {
+        conflict_ = true;
+        return false;
+    }
+    
+    std::string temp_path = directory_ + "/.upload-XXXXXX";
+    int fd = mkstemp(&temp_path[0]);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    files_.push_back({field_, filename, temp_path, 0});
+    
+    file_.open(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file_.is_open()) {
+        return false;
+    }
+    
+    in_file_ = true;
+    return true;
+}
+
+bool MultipartFileSaver::on_part_data(const char* data, size_t length) {
+    if (in_file_) {
+        file_.write(data, length);
+        files_.back().size += length;
+        return file_.good();
+    }
+    
+    if (field_value_.length() + length > kMaxFieldSize || fields_size_ + length > kMaxFieldsSize) {
+        return false;
+    }
+    field_value_.append(data, length);
+    fields_size_ += length;
+    return true;
+}
+
+bool MultipartFileSaver::on_part_end() {
+    if (in_file_) {
+        file_.close();
+        in_file_ = false;
+        return !file_.fail();
+    }
+    
+    fields_[field_] = field_value_;
+    return true;
+}
+
+void MultipartFileSaver::discard_temp_files() {
+    for (auto& file : files_) {
+        if (!file.temp_path.empty()) {
+            unlink(file.temp_path.c_str());
+            file.temp_path.clear();
+        }
+    }
+}
+
+HTTPResponse MultipartFileSaver::finish(bool complete) {
+    if (file_.is_open()) {
+        file_.close();
+    }
+    
+    // Move the files to their names only now that the body is known to be complete;
+    // link() fails rather than replace a file that appeared in the meantime
+    size_t moved = 0;
+    while (complete && !conflict_ && moved < files_.size()) {
+        SavedFile& file = files_[moved];
+        if (link(file.temp_path.c_str(), (directory_ + "/" + file.filename).c_str()) != 0) {
+            conflict_ = errno == EEXIST;
+            complete = false;
+            break;
+        }
+        ++moved;
+    }
+    
+    if (!complete || conflict_) {
+        // All or nothing: take back the files already moved
+        for (size_t i = 0; i < moved; ++i) {
+            unlink((directory_ + "/" + files_[i].filename).c_str());
+        }
+        discard_temp_files();
+        if (conflict_) {
+            HTTPResponse response;
+            response.set_status_code(HTTPResponse::StatusCode::CONFLICT);
+            response.set_text_response("A file with that name already exists");
+            return response;
+        }
+        return HTTPResponse::bad_request("Malformed, truncated or rejected multipart body");
+    }
+    discard_temp_files();
+    
+    HTTPResponse response;
+    response.set_status_code(HTTPResponse::StatusCode::CREATED);
+    response.set_content_type("application/json");
+    
+    JsonWriter json(response.get_body_buffer());
+    json.begin_object();
+    json.key("files").begin_array();
+    for (const auto& file : files_) {
+        json.begin_object()
+            .key("field").value(file.field)
+            .key("filename").value(file.filename)
+            .key("size").value(file.size)
+            .end_object();
+    }
+    json.end_array();
+    
+    json.key("fields").begin_object();
+    for (const auto& field : fields_) {
+        json.key(field.first).value(field.second);
+    }
+    json.end_object();
+    json.end_object();
+    
+    return response;
+}
@@ -0,0 +1,210 @@
+#include "response_cache.h"
+#include <thread>
+
+namespace {
+
+void append_component(std::string& key, std::string_view value) {
+    key += std::to_string(value.length());
+    key += ':';
+    key.append(value.data(), value.length());
+}
+
+}
+
+ResponseCache::ResponseCache(size_t max_bytes, size_t num_shards)
+    : shard_budget_(max_bytes / (num_shards ? num_shards : 1)), revalidations_(0) {
+    if (num_shards == 0) num_shards = 1;
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+}
+
+ResponseCache::~ResponseCache() {
+    // Revalidation threads hold references to the shards and route callbacks
+    std::unique_lock<std::mutex> lock(revalidate_mutex_);
+    revalidate_cv_.wait(lock, [this] { return revalidations_ == 0; });
+}
+
+std::string ResponseCache::make_key(const HTTPRequest& request, const Policy& policy) {
+    // Components are length-prefixed and each parameter's values counted, so no decoded
+    // query value or header value can fake a boundary (as a separator byte could)
+    std::string key = HTTPRequest::method_to_string(request.get_method());
+    key += ' ';
+    append_component(key, request.get_path());
+    
+    if (policy.query_params.empty()) {
+        append_component(key, request.get_query_string());
+    } else {
+        UrlEncodedParams query = request.query();
+        for (const auto& name : policy.query_params) {
+            std::vector<std::string_view> values = query.get_all(name);
+            key += std::to_string(values.size());
+            key += '#';
+            for (std::string_view value : values) {
+                append_component(key, value);
+            }
+        }
+    }
+    
+    for (const auto& name : policy.vary_headers) {
+        append_component(key, request.get_header(name));
+    }
+    
+    return key;
+}
+
+HTTPResponse ResponseCache::get_or_generate(const HTTPRequest& request, const Policy& policy,
+                                            const Generator& generate) {
+    std::string key = make_key(request, policy);
+    Shard& shard = shard_for(key);
+    
+    std::promise<Serialized> promise;
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto now = Clock::now();
+        
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            Entry& entry = it->second;
+            if (now < entry.stale_until) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru_position);
+                Serialized cached = entry.response;
+                
+                // Expired but within the stale window: serve it and refresh in the background
+                if (now >= entry.fresh_until && shard.pending.find(key) == shard.pending.end()) {
+                    lock.unlock();
+                    revalidate(shard, key, policy, request, generate);
+                }
+                return HTTPResponse::from_serialized(cached);
+            }
+        }
+        
+        // Someone is already generating this key: wait for their result
+        auto pending = shard.pending.find(key);
+        if (pending != shard.pending.end()) {
+            std::shared_future<Serialized> result = pending->second;
+            lock.unlock();
+            return HTTPResponse::from_serialized(result.get());
+        }
+        
+        shard.pending.emplace(key, promise.get_future().share());
+    }
+    
+    HTTPResponse response;
+    generate_and_store(shard, key, policy, request, generate, promise, &response);
+    return response;
+}
+
+ResponseCache::Serialized ResponseCache::generate_and_store(Shard& shard, const std::string& key,
+                                                            const Policy& policy, const HTTPRequest& request,
+                                                            const Generator& generate,
+                                                            std::promise<Serialized>& promise,
+                                                            HTTPResponse* response) {
+    Serialized serialized;
+    try {
+        HTTPResponse generated = generate(request);
+        serialized = generated.serialize();
+        
+        // Only successful responses are cached; errors are shared with waiters but not stored
+        if (generated.get_status_code() == HTTPResponse::StatusCode::OK) {
+            store(shard, key, policy, serialized);
+        }
+        if (response) {
+            *response = std::move(generated);
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.pending.erase(key);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.pending.erase(key);
+    }
+    promise.set_value(serialized);
+    return serialized;
+}
+
+void ResponseCache::store(Shard& shard, const std::string& key, const Policy& policy,
+                          const Serialized& response) {
+    size_t bytes = key.length() + response->length() + sizeof(Entry);
+    if (bytes > shard_budget_) {
+        return;
+    }
+    
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        shard.bytes -= it->second.bytes;
+        shard.lru.erase(it->second.lru_position);
+        shard.entries.erase(it);
+    }
+    
+    // Evict least recently used entries until the new one fits the shard's byte budget
+    while (shard.bytes + bytes > shard_budget_ && !shard.lru.empty()) {
+        auto victim = shard.entries.find(shard.lru.back());
+        shard.bytes -= victim->second.bytes;
+        shard.entries.erase(victim);
+        shard.lru.pop_back();
+    }
+    
+    shard.lru.push_front(key);
+    shard.entries[key] = Entry{response, now + policy.ttl, now + policy.ttl + policy.stale_while_revalidate,
+                               bytes, shard.lru.begin()};
+    shard.bytes += bytes;
+}
+
+void ResponseCache::revalidate(Shard& shard, const std::string& key, const Policy& policy,
+                               const HTTPRequest& request, const Generator& generate) {
+    auto promise = std::make_shared<std::promise<Serialized>>();
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!shard.pending.emplace(key, promise->get_future().share()).second) {
+            return;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(revalidate_mutex_);
+        ++revalidations_;
+    }
+    
+    std::thread([this, &shard, key, policy, request, generate, promise]() {
+        try {
+            generate_and_store(shard, key, policy, request, generate, *promise, nullptr);
+        } catch (...) {
+            // Keep serving the stale copy; the next request after it expires retries
+        }
+        
+        std::lock_guard<std::mutex> lock(revalidate_mutex_);
+        --revalidations_;
+        revalidate_cv_.notify_all();
+    }).detach();
+}
+
+void ResponseCache::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->entries.clear();
+        shard->lru.clear();
+        shard->bytes = 0;
+    }
+}
+
+size_t ResponseCache::size_bytes() const {
+    size_t total = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->bytes;
+    }
+    return total;
+}
+
+ResponseCache::Shard& ResponseCache::shard_for(const std::string& key) {
+    return *shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
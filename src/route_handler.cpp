@@ -1,10 +1,17 @@
 #include "route_handler.h"
+#include "upstream_pool.h"
+#include "json_writer.h"
+#include "trace.h"
 #include <sstream>
 #include <algorithm>
 #include <fstream>
 #include <filesystem>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-RouteHandler::RouteHandler() {
+RouteHandler::RouteHandler() : proxy_route_count_(0), cached_echo_generations_(0) {
     register_default_routes();
 }
 
@@ -12,7 +19,60 @@ void RouteHandler::register_route(const std::string& method, const std::string&
     routes_.push_back({method, path, callback});
 }
 
+void RouteHandler::register_cached_route(const std::string& method, const std::string& path,
+                                         RouteCallback callback, const ResponseCache::Policy& policy) {
+    register_route(method, path, [this, callback, policy](const HTTPRequest& req) {
+        return response_cache_.get_or_generate(req, policy, callback);
+    });
+}
+
+void RouteHandler::register_multipart_route(const std::string& path, MultipartFactory factory) {
+    multipart_routes_.push_back({path, factory});
+}
+
+const RouteHandler::MultipartFactory* RouteHandler::find_multipart_route(const HTTPRequest& request) const {
+    if (request.get_method() != HTTPRequest::Method::POST) {
+        return nullptr;
+    }
+    
+    // Proxy routes take precedence, so a proxied upload is forwarded whole
+    for (size_t i = 0; i < proxy_route_count_; ++i) {
+        if (routes_[i].method == "POST" && path_matches(routes_[i].path, request.get_path())) {
+            return nullptr;
+        }
+    }
+    
+    for (const auto& route : multipart_routes_) {
+        if (path_matches(route.path, request.get_path())) {
+            return &route.factory;
+        }
+    }
+    return nullptr;
+}
+
+void RouteHandler::register_proxy_route(const std::string& path, std::shared_ptr<UpstreamPool> upstreams) {
+    RouteCallback callback = [upstreams](const HTTPRequest& req) { return upstreams->forward(req); };
+    
+    // Matched before every other route, in the order proxies were registered
+    for (const char* method : {"GET", "POST", "PUT", "DELETE", "HEAD", "OPTIONS"}) {
+        routes_.insert(routes_.begin() + proxy_route_count_++, {method, path, callback});
+    }
+}
+
 HTTPResponse RouteHandler::handle_request(const HTTPRequest& request) {
+    const Route* match = find_route(request);
+    if (match) {
+        TRACE_SCOPE(CALLBACK);
+        return match->callback(request);
+    }
+    
+    // No matching route found
+    return HTTPResponse::not_found("Route not found: " + request.get_path());
+}
+
+const RouteHandler::Route* RouteHandler::find_route(const HTTPRequest& request) const {
+    TRACE_SCOPE(ROUTE);
+    
     std::string method_str;
     switch (request.get_method()) {
         case HTTPRequest::Method::GET: method_str = "GET"; break;
@@ -24,20 +84,19 @@ HTTPResponse RouteHandler::handle_request(const HTTPRequest& request) {
         default: method_str = "UNKNOWN"; break;
     }
     
-    // Find matching route
     for (const auto& route : routes_) {
         if (route.method == method_str && path_matches(route.path, request.get_path())) {
-            return route.callback(request);
+            return &route;
         }
     }
-    
-    // No matching route found
-    return HTTPResponse::not_found("Route not found: " + request.get_path());
+    return nullptr;
 }
 
 void RouteHandler::register_default_routes() {
-    // Root route
-    register_route("GET", "/", [this](const HTTPRequest& req) { return handle_root(req); });
+    // Root route (static page, served from the response cache)
+    ResponseCache::Policy root_policy;
+    root_policy.ttl = std::chrono::seconds(60);
+    register_cached_route("GET", "/", [this](const HTTPRequest& req) { return handle_root(req); }, root_policy);
     
     // Health check route
     register_route("GET", "/health", [this](const HTTPRequest& req) { return handle_health(req); });
@@ -46,8 +105,27 @@ void RouteHandler::register_default_routes() {
     register_route("GET", "/echo", [this](const HTTPRequest& req) { return handle_echo(req); });
     register_route("POST", "/echo", [this](const HTTPRequest& req) { return handle_echo(req); });
     
+    // Slow echo behind the response cache, keyed on ?name= and Accept-Language
+    ResponseCache::Policy cached_echo_policy;
+    cached_echo_policy.ttl = std::chrono::seconds(60);
+    cached_echo_policy.query_params = {"name"};
+    cached_echo_policy.vary_headers = {"Accept-Language"};
+    register_cached_route("GET", "/echo/cached", [this](const HTTPRequest& req) { return handle_cached_echo(req); },
+                          cached_echo_policy);
+    
     // Static file serving
     register_route("GET", "/static", [this](const HTTPRequest& req) { return handle_static_file(req); });
+    register_route("GET", "/static/*", [this](const HTTPRequest& req) { return handle_static_file(req); });
+    
+    // Sampled request traces (builds with tracing only)
+    if (Tracer::is_supported()) {
+        register_route("GET", "/debug/trace", [](const HTTPRequest&) {
+            HTTPResponse response;
+            response.set_content_type("application/json");
+            response.get_body_buffer() = Tracer::to_json();
+            return response;
+        });
+    }
 }
 
 bool RouteHandler::path_matches(const std::string& route_path, const std::string& request_path) const {
@@ -116,6 +194,11 @@ HTTPResponse RouteHandler::handle_root(const HTTPRequest& request) {
             <div class="description">Echo endpoint - returns request data</div>
         </div>
         
+        <div class="endpoint">
+            <div><span class="method">GET</span> <span class="path">/echo/cached</span></div>
+            <div class="description">Cached echo - keyed on ?name= and Accept-Language</div>
+        </div>
+        
         <div class="endpoint">
             <div><span class="method">GET</span> <span class="path">/static</span></div>
             <div class="description">Static file serving (if files exist)</div>
@@ -143,60 +226,89 @@ HTTPResponse RouteHandler::handle_root(const HTTPRequest& request) {
 }
 
 HTTPResponse RouteHandler::handle_health(const HTTPRequest& request) {
-    std::string json = R"({
-    "status": "healthy",
-    "server": "C++ HTTP Server",
-    "timestamp": ")" + std::to_string(time(nullptr)) + R"(",
-    "uptime": "running"
-})";
-    
     HTTPResponse response;
-    response.set_json_response(json);
+    response.set_content_type("application/json");
+    
+    JsonWriter json(response.get_body_buffer());
+    json.begin_object()
+        .key("status").value("healthy")
+        .key("server").value("C++ HTTP Server")
+        .key("timestamp").value(std::to_string(time(nullptr)))
+        .key("uptime").value("running")
+        .end_object();
+    
     return response;
 }
 
 HTTPResponse RouteHandler::handle_echo(const HTTPRequest& request) {
-    std::ostringstream json;
-    json << "{\n";
-    json << "  \"method\": \"";
-    
-    switch (request.get_method()) {
-        case HTTPRequest::Method::GET: json << "GET"; break;
-        case HTTPRequest::Method::POST: json << "POST"; break;
-        case HTTPRequest::Method::PUT: json << "PUT"; break;
-        case HTTPRequest::Method::DELETE: json << "DELETE"; break;
-        case HTTPRequest::Method::HEAD: json << "HEAD"; break;
-        case HTTPRequest::Method::OPTIONS: json << "OPTIONS"; break;
-        default: json << "UNKNOWN"; break;
-    }
+    HTTPResponse response;
+    response.set_content_type("application/json");
     
-    json << "\",\n";
-    json << "  \"path\": \"" << request.get_path() << "\",\n";
-    json << "  \"version\": \"" << request.get_version() << "\",\n";
-    json << "  \"headers\": {\n";
+    JsonWriter json(response.get_body_buffer());
+    json.begin_object();
+    json.key("method").value(HTTPRequest::method_to_string(request.get_method()));
+    json.key("path").value(request.get_path());
+    json.key("version").value(request.get_version());
     
-    bool first_header = true;
+    json.key("headers").begin_object();
     for (const auto& header : request.get_headers()) {
-        if (!first_header) json << ",\n";
-        json << "    \"" << header.first << "\": \"" << header.second << "\"";
-        first_header = false;
+        json.key(header.first).value(header.second);
     }
-    json << "\n  },\n";
+    json.end_object();
     
-    json << "  \"query_params\": {\n";
-    bool first_param = true;
-    for (const auto& param : request.get_query_params()) {
-        if (!first_param) json << ",\n";
-        json << "    \"" << param.first << "\": \"" << param.second << "\"";
-        first_param = false;
+    // Repeated keys are echoed as arrays
+    auto query_params = request.get_query_params();
+    json.key("query_params").begin_object();
+    for (auto it = query_params.begin(); it != query_params.end(); it = query_params.upper_bound(it->first)) {
+        json.key(it->first);
+        if (query_params.count(it->first) == 1) {
+            json.value(it->second);
+            continue;
+        }
+        json.begin_array();
+        auto range = query_params.equal_range(it->first);
+        for (auto value = range.first; value != range.second; ++value) {
+            json.value(value->second);
+        }
+        json.end_array();
     }
-    json << "\n  },\n";
+    json.end_object();
     
-    json << "  \"body\": \"" << request.get_body() << "\"\n";
-    json << "}";
+    UrlEncodedParams form = request.form();
+    if (!form.empty()) {
+        json.key("form").begin_object();
+        form.for_each([&json](std::string_view name, std::string_view value) {
+            json.key(name).value(value);
+        });
+        json.end_object();
+    }
+    
+    json.key("body").value(request.get_body());
+    json.end_object();
+    
+    return response;
+}
+
+HTTPResponse RouteHandler::handle_cached_echo(const HTTPRequest& request) {
+    // Stands in for an expensive page: concurrent misses should wait on one generation
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
     
     HTTPResponse response;
-    response.set_json_response(json.str());
+    response.set_content_type("application/json");
+    
+    // The decoded values point into the params object, so it has to outlive the loop
+    UrlEncodedParams query = request.query();
+    JsonWriter json(response.get_body_buffer());
+    json.begin_object();
+    json.key("name").begin_array();
+    for (std::string_view name : query.get_all("name")) {
+        json.value(name);
+    }
+    json.end_array();
+    json.key("language").value(request.get_header("Accept-Language"));
+    json.key("generation").value(++cached_echo_generations_);
+    json.end_object();
+    
     return response;
 }
 
@@ -217,20 +329,21 @@ HTTPResponse RouteHandler::handle_static_file(const HTTPRequest& request) {
         return HTTPResponse::bad_request("Invalid path");
     }
     
-    // Try to serve from current directory
-    std::string file_path = "." + path;
+    // Serve from the ./static document root only, never the rest of the working directory
+    // (which may hold the TLS key)
+    std::string file_path = "./static" + path;
     
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file.is_open()) {
+    // The file is sent with sendfile(), never read into memory
+    int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode)) {
+        if (fd >= 0) close(fd);
         return HTTPResponse::not_found("File not found: " + path);
     }
     
-    std::string content((std::istreambuf_iterator<char>(file)),
-                        std::istreambuf_iterator<char>());
-    
     HTTPResponse response;
     response.set_status_code(HTTPResponse::StatusCode::OK);
-    response.set_body(content);
+    response.set_file_body(fd, file_stat.st_size);
     
     // Set appropriate content type based on file extension
     if (path.length() >= 5 && path.substr(path.length() - 5) == ".html") {
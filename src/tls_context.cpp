@@ -0,0 +1,128 @@
+#include "tls_context.h"
+#include <iostream>
+#include <cstring>
+#ifdef HTTP_SERVER_WITH_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+namespace {
+
+#ifdef HTTP_SERVER_WITH_TLS
+std::string last_tls_error() {
+    char message[256];
+    ERR_error_string_n(ERR_get_error(), message, sizeof(message));
+    return message;
+}
+#endif
+
+}
+
+TlsContext::TlsContext()
+    : ctx_(nullptr), alpn_protocols_{"http/1.1"} {
+}
+
+TlsContext::~TlsContext() {
+#ifdef HTTP_SERVER_WITH_TLS
+    if (ctx_) {
+        SSL_CTX_free(ctx_);
+    }
+#endif
+}
+
+bool TlsContext::is_supported() {
+#ifdef HTTP_SERVER_WITH_TLS
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool TlsContext::load(const std::string& cert_file, const std::string& key_file) {
+#ifdef HTTP_SERVER_WITH_TLS
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if (!ctx_) {
+        std::cerr << "Error creating TLS context: " << last_tls_error() << std::endl;
+        return false;
+    }
+    
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx_, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION);
+    
+    // Hand record encryption to the kernel where supported so sendfile() stays zero-copy
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+#endif
+    
+    // Session resumption: stateless tickets (on by default) plus a server-side
+    // session cache for clients that resume by session ID
+    static const unsigned char kSessionContext[] = "cpp-http-server";
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx_, 20480);
+    SSL_CTX_set_session_id_context(ctx_, kSessionContext, sizeof(kSessionContext) - 1);
+    SSL_CTX_set_timeout(ctx_, 3600);
+    
+    if (SSL_CTX_use_certificate_chain_file(ctx_, cert_file.c_str()) != 1) {
+        std::cerr << "Error loading certificate " << cert_file << ": " << last_tls_error() << std::endl;
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx_, key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx_) != 1) {
+        std::cerr << "Error loading private key " << key_file << ": " << last_tls_error() << std::endl;
+        return false;
+    }
+    
+    SSL_CTX_set_alpn_select_cb(ctx_, &TlsContext::select_alpn, this);
+    return true;
+#else
+    (void)cert_file;
+    (void)key_file;
+    std::cerr << "TLS requested but the server was built without OpenSSL" << std::endl;
+    return false;
+#endif
+}
+
+std::unique_ptr<Connection> TlsContext::accept(int fd) {
+#ifdef HTTP_SERVER_WITH_TLS
+    SSL* ssl = SSL_new(ctx_);
+    if (!ssl) {
+        return nullptr;
+    }
+    
+    SSL_set_fd(ssl, fd);
+    if (SSL_accept(ssl) != 1) {
+        ERR_clear_error();
+        SSL_free(ssl);
+        return nullptr;
+    }
+    
+    return std::make_unique<Connection>(fd, ssl);
+#else
+    (void)fd;
+    return nullptr;
+#endif
+}
+
+int TlsContext::select_alpn(ssl_st* ssl, const unsigned char** out, unsigned char* out_length,
+                            const unsigned char* in, unsigned int in_length, void* arg) {
+#ifdef HTTP_SERVER_WITH_TLS
+    (void)ssl;
+    const TlsContext* context = static_cast<const TlsContext*>(arg);
+    
+    // Our preference order wins; the client's list is length-prefixed protocol names
+    for (const auto& protocol : context->alpn_protocols_) {
+        for (unsigned int i = 0; i < in_length; i += in[i] + 1) {
+            if (in[i] == protocol.length() && i + 1 + in[i] <= in_length &&
+                memcmp(in + i + 1, protocol.data(), protocol.length()) == 0) {
+                *out = in + i + 1;
+                *out_length = in[i];
+                return SSL_TLSEXT_ERR_OK;
+            }
+        }
+    }
+    return SSL_TLSEXT_ERR_NOACK;
+#else
+    (void)ssl; (void)out; (void)out_length; (void)in; (void)in_length; (void)arg;
+    return 0;
+#endif
+}
@@ -0,0 +1,219 @@
+#include "trace.h"
+#include "json_writer.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#ifdef HTTP_SERVER_WITH_TRACING
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace {
+
+int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifdef HTTP_SERVER_WITH_TRACING
+constexpr size_t kRingCapacity = 4096;
+
+struct Event {
+    uint64_t start;
+    uint64_t end;
+    uint64_t request_id;
+    uint32_t tid;
+    Tracer::Phase phase;
+};
+
+// Events of one thread, oldest overwritten first. Only the owning thread writes; the
+// lock is there for the exporter, so it is uncontended on the hot path.
+struct Ring {
+    std::mutex mutex;
+    std::vector<Event> events;
+    size_t count = 0;   // Events ever written
+};
+
+// Connections get a thread each, so rings outlive their threads: a finished thread hands
+// its ring back to the pool (events intact) and the next thread to trace picks it up
+struct RingPool {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    std::vector<Ring*> free_rings;
+};
+
+RingPool& ring_pool() {
+    static RingPool* pool = new RingPool();   // Never destroyed: threads may exit after main
+    return *pool;
+}
+
+struct RingLease {
+    Ring* ring = nullptr;
+    uint32_t tid = 0;
+    
+    ~RingLease() {
+        if (ring) {
+            std::lock_guard<std::mutex> lock(ring_pool().mutex);
+            ring_pool().free_rings.push_back(ring);
+        }
+    }
+};
+
+thread_local RingLease lease;
+
+Ring& acquire_ring() {
+    if (!lease.ring) {
+        RingPool& pool = ring_pool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.free_rings.empty()) {
+            pool.rings.push_back(std::make_unique<Ring>());
+            pool.rings.back()->events.resize(kRingCapacity);
+            lease.ring = pool.rings.back().get();
+        } else {
+            lease.ring = pool.free_rings.back();
+            pool.free_rings.pop_back();
+        }
+        lease.tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    }
+    return *lease.ring;
+}
+
+std::atomic<uint32_t> sample_rate{0};
+std::atomic<uint64_t> request_counter{0};
+
+// Tick and clock readings taken together when tracing is turned on; export converts
+// ticks to microseconds against the clock elapsed since
+std::atomic<uint64_t> base_ticks{0};
+std::atomic<int64_t> base_ns{0};
+
+const char* phase_name(Tracer::Phase phase) {
+    switch (phase) {
+        case Tracer::Phase::CONNECTION: return "connection";
+        case Tracer::Phase::ACCEPT: return "accept";
+        case Tracer::Phase::HANDSHAKE: return "handshake";
+        case Tracer::Phase::RECV: return "recv";
+        case Tracer::Phase::PARSE: return "parse";
+        case Tracer::Phase::ROUTE: return "route";
+        case Tracer::Phase::CALLBACK: return "callback";
+        case Tracer::Phase::UPLOAD: return "upload";
+        case Tracer::Phase::SEND: return "send";
+        case Tracer::Phase::STREAM: return "stream";
+    }
+    return "unknown";
+}
+#endif
+
+}
+
+bool Tracer::is_supported() {
+#ifdef HTTP_SERVER_WITH_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Tracer::set_sample_rate(uint32_t n) {
+#ifdef HTTP_SERVER_WITH_TRACING
+    if (n && base_ticks.load() == 0) {
+        base_ns = steady_ns();
+        base_ticks = now();
+    }
+    sample_rate = n;
+#else
+    (void)n;
+#endif
+}
+
+uint32_t Tracer::get_sample_rate() {
+#ifdef HTTP_SERVER_WITH_TRACING
+    return sample_rate.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+void Tracer::begin_request() {
+#ifdef HTTP_SERVER_WITH_TRACING
+    uint32_t rate = sample_rate.load(std::memory_order_relaxed);
+    if (rate == 0) {
+        sampled_ = false;
+        return;
+    }
+    uint64_t id = request_counter.fetch_add(1, std::memory_order_relaxed);
+    sampled_ = id % rate == 0;
+    request_id_ = id;
+#endif
+}
+
+uint64_t Tracer::now() {
+#if defined(HTTP_SERVER_WITH_TRACING) && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(steady_ns());
+#endif
+}
+
+void Tracer::record(Phase phase, uint64_t start, uint64_t end) {
+#ifdef HTTP_SERVER_WITH_TRACING
+    Ring& ring = acquire_ring();
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    ring.events[ring.count++ % kRingCapacity] = {start, end, request_id_, lease.tid, phase};
+#else
+    (void)phase;
+    (void)start;
+    (void)end;
+#endif
+}
+
+std::string Tracer::to_json() {
+    std::string out;
+    JsonWriter json(out);
+    json.begin_object().key("traceEvents").begin_array();
+    
+#ifdef HTTP_SERVER_WITH_TRACING
+    // Calibrate: ticks per microsecond over the whole time tracing has been on
+    uint64_t origin = base_ticks.load();
+    uint64_t ticks = now();
+    double elapsed_us = (steady_ns() - base_ns.load()) / 1000.0;
+    double ticks_per_us = elapsed_us > 0 && ticks > origin ? (ticks - origin) / elapsed_us : 1000.0;
+    int pid = getpid();
+    
+    RingPool& pool = ring_pool();
+    std::lock_guard<std::mutex> pool_lock(pool.mutex);
+    for (const auto& ring : pool.rings) {
+        std::lock_guard<std::mutex> lock(ring->mutex);
+        size_t first = ring->count > kRingCapacity ? ring->count - kRingCapacity : 0;
+        for (size_t i = first; i < ring->count; ++i) {
+            const Event& event = ring->events[i % kRingCapacity];
+            // Complete event: timestamps in microseconds from when tracing was turned on
+            json.begin_object()
+                .key("name").value(phase_name(event.phase))
+                .key("cat").value("http")
+                .key("ph").value("X")
+                .key("ts").value(static_cast<int64_t>(event.start - origin) / ticks_per_us)
+                .key("dur").value((event.end - event.start) / ticks_per_us)
+                .key("pid").value(pid)
+                .key("tid").value(event.tid)
+                .key("args").begin_object().key("request").value(event.request_id).end_object()
+                .end_object();
+        }
+    }
+#endif
+    
+    json.end_array().key("displayTimeUnit").value("ns").end_object();
+    return out;
+}
+
+bool Tracer::write_json(const std::string& path) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::string trace = to_json();
+    file.write(trace.data(), trace.length());
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,457 @@
+#include "upstream_pool.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <set>
+#include <cstring>
+#include <cctype>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace {
+
+bool iequals(const std::string& a, const char* b) {
+    size_t len = strlen(b);
+    if (a.length() != len) return false;
+    for (size_t i = 0; i < len; ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Headers that only apply to a single connection and must not be forwarded
+bool is_hop_by_hop(const std::string& name) {
+    return iequals(name, "Connection") || iequals(name, "Keep-Alive") ||
+           iequals(name, "Proxy-Connection") || iequals(name, "Proxy-Authenticate") ||
+           iequals(name, "Proxy-Authorization") || iequals(name, "TE") ||
+           iequals(name, "Trailer") || iequals(name, "Transfer-Encoding") ||
+           iequals(name, "Upgrade");
+}
+
+bool is_idempotent(HTTPRequest::Method method) {
+    return method != HTTPRequest::Method::POST && method != HTTPRequest::Method::UNKNOWN;
+}
+
+}
+
+UpstreamPool::UpstreamPool(Balancing balancing)
+    : balancing_(balancing), max_idle_(32), max_response_size_(16 * 1024 * 1024), max_fails_(3),
+      fail_timeout_(std::chrono::seconds(10)), next_(0) {
+}
+
+UpstreamPool::~UpstreamPool() {
+    for (auto& upstream : upstreams_) {
+        for (int fd : upstream->idle) {
+            close(fd);
+        }
+    }
+}
+
+void UpstreamPool::add_upstream(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    upstreams_.push_back(std::unique_ptr<Upstream>(
+        new Upstream{host, port, {}, 0, 0, std::chrono::steady_clock::time_point()}));
+}
+
+bool UpstreamPool::add_upstreams(const std::string& list) {
+    std::istringstream stream(list);
+    std::string entry;
+    
+    while (std::getline(stream, entry, ',')) {
+        size_t colon_pos = entry.rfind(':');
+        if (colon_pos == std::string::npos || colon_pos == 0) {
+            return false;
+        }
+        int port = std::atoi(entry.c_str() + colon_pos + 1);
+        if (port <= 0 || port > 65535) {
+            return false;
+        }
+        add_upstream(entry.substr(0, colon_pos), port);
+    }
+    
+    return !upstreams_.empty();
+}
+
+HTTPResponse UpstreamPool::forward(const HTTPRequest& request) {
+    bool head_request = request.get_method() == HTTPRequest::Method::HEAD;
+    std::vector<Upstream*> tried;
+    
+    while (Upstream* upstream = select_upstream(tried)) {
+        tried.push_back(upstream);
+        std::string request_data = serialize_request(request, *upstream);
+        
+        // A pooled connection may have been closed by the upstream while idle;
+        // retry those on a fresh connection without counting a failure
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = false;
+            int fd = acquire_connection(*upstream, reused);
+            if (fd < 0) {
+                break;
+            }
+            
+            HTTPResponse response;
+            bool reusable = false;
+            Result result = exchange(fd, request_data, head_request, response, reusable);
+            release_connection(*upstream, fd, result == Result::OK && reusable);
+            
+            if (result == Result::OK) {
+                record_result(*upstream, true);
+                return response;
+            }
+            if (result == Result::TOO_LARGE) {
+                record_result(*upstream, true);
+                return HTTPResponse::bad_gateway("Upstream response too large");
+            }
+            
+            // Once the request is on the wire the upstream may have acted on it: only
+            // idempotent requests are replayed
+            bool replayable = result == Result::STALE_CONNECTION || is_idempotent(request.get_method());
+            if (!replayable) {
+                record_result(*upstream, false);
+                return HTTPResponse::bad_gateway("Upstream failed mid-request");
+            }
+            if (result != Result::FAILED && reused) {
+                continue;
+            }
+            break;
+        }
+        
+        record_result(*upstream, false);
+    }
+    
+    if (tried.empty()) {
+        return HTTPResponse::service_unavailable("No healthy upstream available");
+    }
+    return HTTPResponse::bad_gateway("Upstream unavailable");
+}
+
+UpstreamPool::Upstream* UpstreamPool::select_upstream(const std::vector<Upstream*>& tried) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    Upstream* selected = nullptr;
+    
+    for (size_t i = 0; i < upstreams_.size(); ++i) {
+        // Round-robin starts from the next upstream in turn; least-connections scans them all
+        Upstream* candidate = upstreams_[(next_ + i) % upstreams_.size()].get();
+        if (candidate->down_until > now ||
+            std::find(tried.begin(), tried.end(), candidate) != tried.end()) {
+            continue;
+        }
+        
+        if (balancing_ == Balancing::ROUND_ROBIN) {
+            selected = candidate;
+            break;
+        }
+        if (!selected || candidate->active < selected->active) {
+            selected = candidate;
+        }
+    }
+    
+    if (selected) {
+        ++next_;
+        ++selected->active;
+    }
+    return selected;
+}
+
+int UpstreamPool::acquire_connection(Upstream& upstream, bool& reused) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (!upstream.idle.empty()) {
+            int fd = upstream.idle.back();
+            upstream.idle.pop_back();
+            
+            // An idle connection has nothing to read unless the upstream closed it; catching
+            // that here saves a request that can't be replayed from a dead connection
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 0) != 0) {
+                close(fd);
+                continue;
+            }
+            reused = true;
+            return fd;
+        }
+    }
+    
+    reused = false;
+    return connect_to(upstream.host, upstream.port);
+}
+
+void UpstreamPool::release_connection(Upstream& upstream, int fd, bool reusable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (reusable && upstream.idle.size() < max_idle_) {
+        upstream.idle.push_back(fd);
+    } else {
+        close(fd);
+    }
+}
+
+void UpstreamPool::record_result(Upstream& upstream, bool success) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --upstream.active;
+    
+    if (success) {
+        upstream.fails = 0;
+        return;
+    }
+    
+    // Passive health check: take the upstream out of rotation after repeated failures
+    if (++upstream.fails >= max_fails_) {
+        upstream.down_until = std::chrono::steady_clock::now() + fail_timeout_;
+        upstream.fails = 0;
+        for (int fd : upstream.idle) {
+            close(fd);
+        }
+        upstream.idle.clear();
+        std::cerr << "Upstream " << upstream.host << ":" << upstream.port
+                  << " marked down for " << fail_timeout_.count() << "s" << std::endl;
+    }
+}
+
+std::string UpstreamPool::serialize_request(const HTTPRequest& request, const Upstream& upstream) const {
+    std::ostringstream out;
+    
+    out << HTTPRequest::method_to_string(request.get_method()) << " " << request.get_path();
+    if (!request.get_query_string().empty()) {
+        out << "?" << request.get_query_string();
+    }
+    out << " HTTP/1.1\r\n";
+    
+    bool has_host = false;
+    for (const auto& header : request.get_headers()) {
+        // The body has already been read in full, so the upstream has nothing to confirm
+        if (is_hop_by_hop(header.first) || iequals(header.first, "Content-Length") ||
+            iequals(header.first, "Expect")) {
+            continue;
+        }
+        if (iequals(header.first, "Host")) {
+            has_host = true;
+        }
+        out << header.first << ": " << header.second << "\r\n";
+    }
+    if (!has_host) {
+        out << "Host: " << upstream.host << ":" << upstream.port << "\r\n";
+    }
+    
+    const std::string& body = request.get_body();
+    if (!body.empty() || request.get_method() == HTTPRequest::Method::POST ||
+        request.get_method() == HTTPRequest::Method::PUT) {
+        out << "Content-Length: " << body.length() << "\r\n";
+    }
+    out << "Connection: keep-alive\r\n\r\n";
+    out << body;
+    
+    return out.str();
+}
+
+UpstreamPool::Result UpstreamPool::exchange(int fd, const std::string& request_data, bool head_request,
+                                            HTTPResponse& response, bool& reusable) {
+    // Send request
+    size_t sent = 0;
+    while (sent < request_data.length()) {
+        ssize_t n = send(fd, request_data.data() + sent, request_data.length() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return sent == 0 ? Result::STALE_CONNECTION : Result::FAILED;
+        }
+        sent += n;
+    }
+    
+    char buffer[16384];
+    std::string data;
+    auto fill = [&]() -> bool {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) return false;
+        data.append(buffer, n);
+        return true;
+    };
+    
+    // Read status line and headers, skipping interim (1xx) responses
+    size_t header_end;
+    std::istringstream head;
+    std::string line;
+    std::string version, reason;
+    int status = 0;
+    do {
+        while ((header_end = data.find("\r\n\r\n")) == std::string::npos) {
+            if (data.length() > kMaxHeaderSize || !fill()) {
+                return data.empty() && status == 0 ? Result::NO_RESPONSE : Result::FAILED;
+            }
+        }
+        
+        head.str(data.substr(0, header_end));
+        head.clear();
+        std::getline(head, line);
+        data.erase(0, header_end + 4);
+        
+        std::istringstream status_line(line);
+        status = 0;
+        status_line >> version >> status;
+        std::getline(status_line, reason);
+        reason.erase(0, reason.find_first_not_of(" "));
+        if (!reason.empty() && reason.back() == '\r') reason.pop_back();
+        if (status < 100 || status > 999 || status == 101) {
+            return Result::FAILED;
+        }
+    } while (status < 200);
+    
+    response.set_status_code(static_cast<HTTPResponse::StatusCode>(status));
+    response.set_status_message(reason);
+    
+    long long content_length = -1;
+    bool chunked = false;
+    bool keep_alive = version == "HTTP/1.1";
+    
+    // An upstream field replaces our default of the same name; repeats (Set-Cookie) are kept
+    std::set<std::string, HTTPRequest::HeaderNameLess> forwarded;
+    while (std::getline(head, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        size_t colon_pos = line.find(':');
+        if (colon_pos == std::string::npos) continue;
+        
+        std::string name = line.substr(0, colon_pos);
+        std::string value = line.substr(colon_pos + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t") + 1);
+        
+        if (iequals(name, "Content-Length")) {
+            content_length = std::atoll(value.c_str());
+        } else if (iequals(name, "Transfer-Encoding")) {
+            chunked = value.find("chunked") != std::string::npos;
+        } else if (iequals(name, "Connection")) {
+            std::string lower = value;
+            std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+            if (lower.find("close") != std::string::npos) keep_alive = false;
+            if (lower.find("keep-alive") != std::string::npos) keep_alive = true;
+        }
+        
+        if (is_hop_by_hop(name)) {
+            continue;
+        }
+        if (forwarded.insert(name).second) {
+            response.add_header(name, value);
+        } else {
+            response.append_header(name, value);
+        }
+    }
+    
+    std::string body;
+    
+    // Read body
+    if (head_request || status == 204 || status == 304) {
+        // No body
+    } else if (chunked) {
+        while (true) {
+            size_t line_end;
+            while ((line_end = data.find("\r\n")) == std::string::npos) {
+                if (data.length() > kMaxHeaderSize || !fill()) return Result::FAILED;
+            }
+            size_t chunk_size = std::strtoul(data.c_str(), nullptr, 16);
+            data.erase(0, line_end + 2);
+            if (chunk_size > max_response_size_ - body.length()) {
+                return Result::TOO_LARGE;
+            }
+            
+            if (chunk_size == 0) {
+                // Skip trailers up to the terminating empty line
+                while (data.find("\r\n") != 0 && data.find("\r\n\r\n") == std::string::npos) {
+                    if (data.length() > kMaxHeaderSize || !fill()) return Result::FAILED;
+                }
+                break;
+            }
+            
+            while (data.length() < chunk_size + 2) {
+                if (!fill()) return Result::FAILED;
+            }
+            body.append(data, 0, chunk_size);
+            data.erase(0, chunk_size + 2);
+        }
+        response.add_header("Content-Length", std::to_string(body.length()));
+    } else if (content_length >= 0) {
+        if (static_cast<unsigned long long>(content_length) > max_response_size_) {
+            return Result::TOO_LARGE;
+        }
+        while (data.length() < static_cast<size_t>(content_length)) {
+            if (!fill()) return Result::FAILED;
+        }
+        body = data.substr(0, content_length);
+    } else {
+        // Delimited by connection close
+        while (fill()) {
+            if (data.length() > max_response_size_) {
+                return Result::TOO_LARGE;
+            }
+        }
+        body = data;
+        keep_alive = false;
+    }
+    
+    response.set_body(body);
+    reusable = keep_alive;
+    return Result::OK;
+}
+
+int UpstreamPool::connect_to(const std::string& host, int port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        std::cerr << "Error resolving upstream " << host << std::endl;
+        return -1;
+    }
+    
+    int fd = -1;
+    for (struct addrinfo* ai = result; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        
+        // Non-blocking connect so a dead upstream can't stall the request for the kernel timeout
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        
+        int rc = connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (rc < 0 && errno == EINPROGRESS) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            if (poll(&pfd, 1, 3000) == 1 &&
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0) {
+                rc = 0;
+            }
+        }
+        
+        if (rc == 0) {
+            fcntl(fd, F_SETFL, flags);
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    
+    if (fd < 0) {
+        std::cerr << "Error connecting to upstream " << host << ":" << port << std::endl;
+        return -1;
+    }
+    
+    struct timeval timeout;
+    timeout.tv_sec = 30;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    
+    return fd;
+}
@@ -0,0 +1,169 @@
+#include "url_encoded.h"
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Position of the first '%' or '+' at or after pos, or text.length() if there is none
+size_t find_escape(std::string_view text, size_t pos) {
+    const char* data = text.data();
+    size_t length = text.length();
+    
+#ifdef __SSE2__
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    
+    while (pos + 16 <= length) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, percent),
+                                                  _mm_cmpeq_epi8(block, plus)));
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#endif
+    
+    for (; pos < length; ++pos) {
+        if (data[pos] == '%' || data[pos] == '+') break;
+    }
+    return pos;
+}
+
+}
+
+std::optional<std::string_view> UrlEncodedParams::get(std::string_view name) const {
+    size_t pos = 0;
+    std::string_view key, value;
+    while (next_pair(pos, key, value)) {
+        if (key_matches(key, name)) {
+            return decode(value);
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<std::string_view> UrlEncodedParams::get_all(std::string_view name) const {
+    std::vector<std::string_view> values;
+    size_t pos = 0;
+    std::string_view key, value;
+    while (next_pair(pos, key, value)) {
+        if (key_matches(key, name)) {
+            values.push_back(decode(value));
+        }
+    }
+    return values;
+}
+
+std::string UrlEncodedParams::decode_to_string(std::string_view encoded) {
+    std::string decoded(encoded.length(), '\0');
+    decoded.resize(decode_into(&decoded[0], encoded));
+    return decoded;
+}
+
+bool UrlEncodedParams::next_pair(size_t& pos, std::string_view& key, std::string_view& value) const {
+    // memchr is vectorised by the C library, so splitting on '&' and '=' stays cheap
+    while (pos < raw_.length()) {
+        const char* start = raw_.data() + pos;
+        size_t remaining = raw_.length() - pos;
+        const char* amp = static_cast<const char*>(memchr(start, '&', remaining));
+        size_t pair_length = amp ? static_cast<size_t>(amp - start) : remaining;
+        pos += pair_length + 1;
+        
+        // Skip empty pairs ("a=1&&b=2")
+        if (pair_length == 0) continue;
+        
+        std::string_view pair(start, pair_length);
+        size_t equal_pos = pair.find('=');
+        if (equal_pos == std::string_view::npos) {
+            key = pair;
+            value = std::string_view();
+        } else {
+            key = pair.substr(0, equal_pos);
+            value = pair.substr(equal_pos + 1);
+        }
+        return true;
+    }
+    return false;
+}
+
+std::string_view UrlEncodedParams::decode(std::string_view encoded) const {
+    // Zero-copy when there is nothing to decode
+    if (find_escape(encoded, 0) == encoded.length()) {
+        return encoded;
+    }
+    
+    char* out = allocate(encoded.length());
+    return std::string_view(out, decode_into(out, encoded));
+}
+
+bool UrlEncodedParams::key_matches(std::string_view encoded_key, std::string_view name) {
+    // Compare while decoding so non-matching keys never allocate
+    size_t i = 0, j = 0;
+    while (i < encoded_key.length()) {
+        char c = encoded_key[i];
+        if (c == '+') {
+            c = ' ';
+            ++i;
+        } else if (c == '%' && i + 2 < encoded_key.length() &&
+                   hex_value(encoded_key[i + 1]) >= 0 && hex_value(encoded_key[i + 2]) >= 0) {
+            c = static_cast<char>(hex_value(encoded_key[i + 1]) * 16 + hex_value(encoded_key[i + 2]));
+            i += 3;
+        } else {
+            ++i;
+        }
+        
+        if (j >= name.length() || name[j] != c) return false;
+        ++j;
+    }
+    return j == name.length();
+}
+
+size_t UrlEncodedParams::decode_into(char* out, std::string_view encoded) {
+    size_t written = 0;
+    size_t pos = 0;
+    
+    while (pos < encoded.length()) {
+        size_t escape = find_escape(encoded, pos);
+        memcpy(out + written, encoded.data() + pos, escape - pos);
+        written += escape - pos;
+        pos = escape;
+        if (pos >= encoded.length()) break;
+        
+        if (encoded[pos] == '+') {
+            out[written++] = ' ';
+            ++pos;
+        } else if (pos + 2 < encoded.length() &&
+                   hex_value(encoded[pos + 1]) >= 0 && hex_value(encoded[pos + 2]) >= 0) {
+            out[written++] = static_cast<char>(hex_value(encoded[pos + 1]) * 16 + hex_value(encoded[pos + 2]));
+            pos += 3;
+        } else {
+            // Malformed escape: keep the '%' literally
+            out[written++] = '%';
+            ++pos;
+        }
+    }
+    
+    return written;
+}
+
+char* UrlEncodedParams::allocate(size_t size) const {
+    if (blocks_.empty() || block_used_ + size > block_size_) {
+        block_size_ = size > 1024 ? size : 1024;
+        blocks_.push_back(std::unique_ptr<char[]>(new char[block_size_]));
+        block_used_ = 0;
+    }
+    
+    char* memory = blocks_.back().get() + block_used_;
+    block_used_ += size;
+    return memory;
+}
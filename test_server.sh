@@ -43,9 +43,39 @@ test_endpoint() {
     echo
 }
 
+FAILURES=0
+
+# Function to check that a response contains the expected text
+check() {
+    local description=$1
+    local actual=$2
+    local expected=$3
+    
+    if [[ "$actual" == *"$expected"* ]]; then
+        echo "   ✅ $description"
+    else
+        echo "   ❌ $description"
+        echo "      expected: $expected"
+        echo "      got:      $(echo "$actual" | head -c 300)"
+        FAILURES=$((FAILURES + 1))
+    fi
+}
+
+# Send a raw request and print the status line of the response
+raw_status() {
+    local port=$1
+    local request=$2
+    
+    exec 3<>"/dev/tcp/127.0.0.1/$port" || return
+    printf '%b' "$request" >&3
+    head -1 <&3
+    exec 3<&-
+}
+
 # Start server in background
+UPLOAD_DIR=$(mktemp -d)
 echo "Starting HTTP server on port 8080..."
-./bin/http_server --port 8080 > server.log 2>&1 &
+./bin/http_server --port 8080 --upload-dir "$UPLOAD_DIR" > server.log 2>&1 &
 SERVER_PID=$!
 
 # Wait for server to start
@@ -69,6 +99,349 @@ test_endpoint "GET" "/echo?name=test&value=123" "" "Echo endpoint with query par
 test_endpoint "POST" "/echo" "Hello from test script!" "Echo endpoint with POST data"
 test_endpoint "GET" "/nonexistent" "" "Non-existent endpoint (should return 404)"
 
+echo "🔍 Testing: Query and form decoding"
+response=$(curl -s "http://localhost:8080/echo?a=1&a=2&na%6De=hello%20world&plus=a+b&empty&pct=%2B%25")
+check "Repeated query keys" "$response" '"a":["1","2"]'
+check "Percent-decoded key and value" "$response" '"name":"hello world"'
+check "'+' decoded as a space" "$response" '"plus":"a b"'
+check "Key without a value" "$response" '"empty":""'
+check "Escaped '+' and '%'" "$response" '"pct":"+%"'
+response=$(curl -s -d 'k=v+w&k2=%41%42' -H 'Content-Type: application/x-www-form-urlencoded' "http://localhost:8080/echo")
+check "Urlencoded form body" "$response" '"form":{"k":"v w","k2":"AB"}'
+echo
+
+echo "🔍 Testing: JSON escaping"
+# Long values take the 16-byte block path, short ones the byte loop
+response=$(curl -s "http://localhost:8080/echo?ctl=%01%1F%0A%09%22%5C&utf8=%C3%A9%E2%82%AC%F0%9F%98%80&bad=%FF%C3&long=aaaaaaaaaaaaaaaaaaaa%01bbbbbbbbbbbbbbbbbbbb%C3%A9cccccccccccccccc%ED%A0%80")
+check "Control characters, quote and backslash escaped" "$response" '"ctl":"\u0001\u001f\n\t\"\\"'
+check "Valid UTF-8 passed through" "$response" '"utf8":"é€😀"'
+check "Invalid UTF-8 replaced with U+FFFD" "$response" '"bad":"\ufffd\ufffd"'
+check "Escapes inside long values" "$response" '"long":"aaaaaaaaaaaaaaaaaaaa\u0001bbbbbbbbbbbbbbbbbbbbécccccccccccccccc\ufffd\ufffd\ufffd"'
+if command -v python3 > /dev/null; then
+    check "Response is valid JSON" "$(echo "$response" | python3 -c 'import json, sys; json.load(sys.stdin); print("valid")' 2>&1)" "valid"
+fi
+echo
+
+echo "🔍 Testing: Repeated headers"
+response=$(curl -s -H "X-Multi: one" -H "X-Multi: two" -H "Cookie: a=1" -H "Cookie: b=2" "http://localhost:8080/echo")
+check "Repeated header joined with ', '" "$response" '"X-Multi":"one, two"'
+check "Repeated Cookie joined with '; '" "$response" '"Cookie":"a=1; b=2"'
+echo
+
+echo "🔍 Testing: Request body framing"
+# Refused before the body is read, so only the heads are sent: unread bytes would reset the connection
+response=$(raw_status 8080 'POST /echo HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n')
+check "Chunked body refused with 501" "$response" "501"
+response=$(raw_status 8080 'POST /echo HTTP/1.1\r\nHost: x\r\n\r\n')
+check "Body without a length refused with 411" "$response" "411"
+response=$(raw_status 8080 'POST /echo HTTP/1.1\r\nHost: x\r\nContent-Length: 12abc\r\n\r\n')
+check "Content-Length '12abc' refused with 400" "$response" "400"
+response=$(raw_status 8080 'POST /echo HTTP/1.1\r\nHost: x\r\nContent-Length: -1\r\n\r\n')
+check "Content-Length '-1' refused with 400" "$response" "400"
+response=$(raw_status 8080 'POST /echo HTTP/1.1\r\nHost: x\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\n')
+check "Repeated Content-Length refused with 400" "$response" "400"
+response=$(raw_status 8080 'GET /health HTTP/1.1\r\nHost: x\r\n\r\n')
+check "GET without a length still served" "$response" "200"
+echo
+
+echo "🔍 Testing: Multipart uploads"
+# A large file is split across many reads; the small one is full of near-boundaries
+head -c 3000000 /dev/urandom > "$UPLOAD_DIR/random.src"
+printf '\r\n--\r\n-\r\n--X\r\n\r\n--' > "$UPLOAD_DIR/tricky.src"
+response=$(curl -s -F "title=report" -F "big=@$UPLOAD_DIR/random.src;filename=random.bin" \
+                -F "small=@$UPLOAD_DIR/tricky.src;filename=tricky.bin" "http://localhost:8080/upload")
+check "Upload accepted" "$response" '"size":3000000'
+check "Form field kept" "$response" '"title":"report"'
+if cmp -s "$UPLOAD_DIR/random.src" "$UPLOAD_DIR/random.bin" && cmp -s "$UPLOAD_DIR/tricky.src" "$UPLOAD_DIR/tricky.bin"; then
+    check "Uploaded files match byte for byte" "match" "match"
+else
+    check "Uploaded files match byte for byte" "differ" "match"
+fi
+response=$(curl -s -w ' status=%{http_code}' -F "small=@$UPLOAD_DIR/random.src;filename=tricky.bin" \
+                "http://localhost:8080/upload")
+check "Existing file not replaced (409)" "$response" "status=409"
+if cmp -s "$UPLOAD_DIR/tricky.src" "$UPLOAD_DIR/tricky.bin"; then
+    check "Existing file left intact" "match" "match"
+else
+    check "Existing file left intact" "differ" "match"
+fi
+parts=()
+for i in $(seq 300); do parts+=(-F "f$i=x"); done
+response=$(curl -s -w ' status=%{http_code}' "${parts[@]}" "http://localhost:8080/upload")
+check "Too many parts refused" "$response" "status=400"
+# Truncated upload: the connection closes before the closing boundary
+exec 3<>/dev/tcp/127.0.0.1/8080
+printf 'POST /upload HTTP/1.1\r\nHost: x\r\nContent-Type: multipart/form-data; boundary=XyZ\r\nContent-Length: 100000\r\n\r\n--XyZ\r\nContent-Disposition: form-data; name="f"; filename="partial.bin"\r\n\r\npartial data' >&3
+exec 3<&-
+sleep 1
+check "Truncated upload leaves no files behind" "$(ls -A "$UPLOAD_DIR" | grep -c 'partial\|^\.upload-')" "0"
+echo
+
+echo "🔍 Testing: Response cache"
+response=$(curl -s "http://localhost:8080/echo/cached?name=a&name=b")
+check "Cached route answers" "$response" '"name":["a","b"]'
+# Decodes to the single value "a<0x02>name=b"; it must not share a key with a and b
+response=$(curl -s "http://localhost:8080/echo/cached?name=a%02name%3Db")
+check "Separator bytes in a value get their own key" "$response" '"name":["a\u0002name=b"]'
+first=$(curl -s "http://localhost:8080/echo/cached?name=hit" | grep -o '"generation":[0-9]*')
+second=$(curl -s "http://localhost:8080/echo/cached?name=hit&other=ignored" | grep -o '"generation":[0-9]*')
+check "Second request is a hit" "$second" "${first:-missing}"
+# Concurrent misses for one key share a single generation
+burst_pids=()
+for i in 1 2 3 4 5; do
+    curl -s "http://localhost:8080/echo/cached?name=burst" > "$UPLOAD_DIR/burst$i" &
+    burst_pids+=($!)
+done
+wait "${burst_pids[@]}"
+response=$(cat "$UPLOAD_DIR"/burst* | grep -o '"generation":[0-9]*' | sort -u | wc -l)
+check "Concurrent misses coalesced" "$response" "1"
+rm -f "$UPLOAD_DIR"/burst*
+english=$(curl -s -H "Accept-Language: en" "http://localhost:8080/echo/cached?name=vary")
+french=$(curl -s -H "Accept-Language: fr" "http://localhost:8080/echo/cached?name=vary")
+check "Vary header selects its own entry" "$french" '"language":"fr"'
+check "Vary header entries kept apart" "$(curl -s -H "Accept-Language: en" "http://localhost:8080/echo/cached?name=vary")" "${english:-missing}"
+echo
+
+echo "🔍 Testing: HTTP/2 (h2c)"
+if curl -V | grep -q HTTP2; then
+    response=$(curl -s --http2-prior-knowledge -w ' version=%{http_version} status=%{http_code}' \
+                    "http://localhost:8080/echo?h2=yes")
+    check "Prior knowledge" "$response" "version=2 status=200"
+    check "Request decoded from HPACK" "$response" '"path":"/echo","version":"HTTP/2.0"'
+    check "Query string from :path" "$response" '"h2":"yes"'
+    check "Lowercase header names" "$response" '"user-agent":'
+    response=$(curl -s --http2 -d "upgraded body" -w ' version=%{http_version} status=%{http_code}' \
+                    "http://localhost:8080/echo")
+    check "Upgrade from HTTP/1.1 (POST)" "$response" '"body":"upgraded body"'
+    check "Upgrade answered over HTTP/2" "$response" "version=2 status=200"
+    rm -f "$UPLOAD_DIR/random.bin"
+    response=$(curl -s --http2-prior-knowledge -F "big=@$UPLOAD_DIR/random.src;filename=random.bin" \
+                    "http://localhost:8080/upload")
+    if cmp -s "$UPLOAD_DIR/random.src" "$UPLOAD_DIR/random.bin"; then
+        check "Upload over HTTP/2 matches byte for byte" "match" "match"
+    else
+        check "Upload over HTTP/2 matches byte for byte" "differ" "match"
+    fi
+else
+    echo "   Skipped: curl was built without HTTP/2 support"
+fi
+
+# Hand-built frames: HPACK literals (one with a multi-byte length), dynamic table
+# references, two streams on one connection, and PING
+if command -v python3 > /dev/null; then
+    response=$(python3 - <<'PYEOF' 2>&1
+import socket, struct
+def frame(t, flags, sid, payload=b""):
+    return struct.pack(">I", len(payload))[1:] + bytes([t, flags]) + struct.pack(">I", sid) + payload
+def lit(name, value, prefix):
+    # Literal with a new name; lengths below 127 fit the 7-bit prefix
+    return bytes([prefix, len(name)]) + name + bytes([len(value)]) + value
+long_value = b"v" * 200
+block1 = (b"\x82\x86" + b"\x44" + bytes([len(b"/echo?n=1")]) + b"/echo?n=1" + b"\x41\x01x" +
+          lit(b"x-test", b"one", 0x40) +
+          b"\x00\x06x-long\x7f\x49" + long_value)          # 200 = 127 + 73: two-byte integer
+block3 = b"\x82\x86\xc0\xbf\xbe"                           # Indexed from the dynamic table
+s = socket.create_connection(("127.0.0.1", 8080), timeout=5)
+s.sendall(b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" + frame(4, 0, 0) + frame(6, 0, 0, b"pingpong") +
+          frame(1, 0x5, 1, block1) + frame(1, 0x5, 3, block3))
+data, bodies, ended, ping_ack = b"", {1: b"", 3: b""}, set(), False
+while len(ended) < 2:
+    chunk = s.recv(65536)
+    if not chunk: break
+    data += chunk
+    while len(data) >= 9 and len(data) >= 9 + int.from_bytes(data[:3], "big"):
+        length, t, flags = int.from_bytes(data[:3], "big"), data[3], data[4]
+        sid = int.from_bytes(data[5:9], "big") & 0x7fffffff
+        payload, data = data[9:9 + length], data[9 + length:]
+        if t == 4 and not flags & 1: s.sendall(frame(4, 1, 0))
+        if t == 6 and flags & 1: ping_ack = payload == b"pingpong"
+        if t == 0: bodies[sid] += payload
+        if t in (0, 1) and flags & 1: ended.add(sid)
+for sid in (1, 3):
+    body = bodies[sid].decode()
+    print("stream%d:%s" % (sid, "ok" if '"x-test":"one"' in body and '"n":"1"' in body else body[:200]))
+print("long:%s" % ("ok" if '"x-long":"' + "v" * 200 in bodies[1].decode() else "missing"))
+print("ping:%s" % ("ok" if ping_ack else "missing"))
+PYEOF
+)
+    check "HPACK literals with incremental indexing" "$response" "stream1:ok"
+    check "HPACK multi-byte integer" "$response" "long:ok"
+    check "HPACK dynamic table on a second stream" "$response" "stream3:ok"
+    check "PING acknowledged" "$response" "ping:ok"
+fi
+echo
+
+echo "🔍 Testing: TLS"
+if command -v openssl > /dev/null; then
+    openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=localhost" \
+                -keyout "$UPLOAD_DIR/key.pem" -out "$UPLOAD_DIR/cert.pem" > /dev/null 2>&1
+    ./bin/http_server --port 8443 --tls-cert "$UPLOAD_DIR/cert.pem" --tls-key "$UPLOAD_DIR/key.pem" > tls.log 2>&1 &
+    TLS_PID=$!
+    sleep 1
+    
+    if grep -q "built without OpenSSL" tls.log; then
+        echo "   Skipped: server built without TLS"
+    else
+        response=$(curl -sk --http1.1 -w ' version=%{http_version}' "https://localhost:8443/echo?tls=yes")
+        check "HTTPS request over HTTP/1.1" "$response" '"tls":"yes"'
+        check "HTTP/1.1 when the client offers only it" "$response" "version=1.1"
+        response=$(openssl s_client -connect 127.0.0.1:8443 -alpn h2,http/1.1 < /dev/null 2>&1)
+        check "ALPN selects h2" "$response" "ALPN protocol: h2"
+        response=$(openssl s_client -connect 127.0.0.1:8443 -alpn http/1.1 < /dev/null 2>&1)
+        check "ALPN selects http/1.1" "$response" "ALPN protocol: http/1.1"
+        if curl -V | grep -q HTTP2; then
+            response=$(curl -sk --http2 -w ' version=%{http_version}' "https://localhost:8443/echo")
+            check "HTTP/2 over TLS" "$response" "version=2"
+        fi
+        openssl s_client -connect 127.0.0.1:8443 -tls1_2 -sess_out "$UPLOAD_DIR/session.pem" < /dev/null > /dev/null 2>&1
+        response=$(openssl s_client -connect 127.0.0.1:8443 -tls1_2 -sess_in "$UPLOAD_DIR/session.pem" < /dev/null 2>&1)
+        check "Session resumed" "$response" "Reused, TLSv1.2"
+    fi
+    
+    kill $TLS_PID 2>/dev/null
+    wait $TLS_PID 2>/dev/null
+    rm -f tls.log
+else
+    echo "   Skipped: openssl not found"
+fi
+echo
+
+echo "🔍 Testing: Reverse proxy"
+if command -v python3 > /dev/null; then
+    # Upstreams: 9101/9102 answer with their port, 9103/9104 log each request and hang up
+    cat > "$UPLOAD_DIR/upstream.py" <<'PYEOF'
+import socket, sys, threading
+def serve(port, drop):
+    listener = socket.socket()
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind(("127.0.0.1", port))
+    listener.listen(16)
+    while True:
+        conn, _ = listener.accept()
+        threading.Thread(target=handle, args=(conn, port, drop), daemon=True).start()
+def handle(conn, port, drop):
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = conn.recv(65536)
+        if not chunk: return conn.close()
+        data += chunk
+    if drop:
+        with open(sys.argv[1], "a") as log: log.write(data.split(b" ")[0].decode() + "\n")
+        return conn.close()
+    body = ("upstream-%d" % port).encode()
+    conn.sendall(b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: close\r\n\r\n" % len(body) + body)
+    conn.close()
+for port, drop in ((9101, False), (9102, False), (9103, True), (9104, True)):
+    threading.Thread(target=serve, args=(port, drop), daemon=True).start()
+threading.Event().wait()
+PYEOF
+    python3 "$UPLOAD_DIR/upstream.py" "$UPLOAD_DIR/dropped.log" &
+    UPSTREAM_PID=$!
+    # Nothing listens on 9109
+    ./bin/http_server --port 8081 --proxy "/rr/*=127.0.0.1:9101,127.0.0.1:9102" \
+                      --proxy "/failover/*=127.0.0.1:9109,127.0.0.1:9101" \
+                      --proxy "/drop/*=127.0.0.1:9103,127.0.0.1:9104" > proxy.log 2>&1 &
+    PROXY_PID=$!
+    sleep 1
+    
+    response="$(curl -s "http://localhost:8081/rr/a") $(curl -s "http://localhost:8081/rr/b")"
+    check "Round-robin reaches the first upstream" "$response" "upstream-9101"
+    check "Round-robin reaches the second upstream" "$response" "upstream-9102"
+    response=""
+    for i in 1 2 3 4; do
+        response+="$(curl -s -w ':%{http_code} ' "http://localhost:8081/failover/x")"
+    done
+    check "Failover to the live upstream" "$response" "upstream-9101:200 upstream-9101:200 upstream-9101:200 upstream-9101:200"
+    response=$(curl -s -o /dev/null -w '%{http_code}' -d "order=1" "http://localhost:8081/drop/orders")
+    check "POST answered 502 when the upstream hangs up" "$response" "502"
+    check "POST not replayed to another upstream" "$(grep -c POST "$UPLOAD_DIR/dropped.log")" "1"
+    
+    kill $PROXY_PID $UPSTREAM_PID 2>/dev/null
+    wait $PROXY_PID $UPSTREAM_PID 2>/dev/null
+    rm -f proxy.log
+else
+    echo "   Skipped: python3 not found"
+fi
+echo
+
+echo "🔍 Testing: CPU placement"
+for list in abc 1x 0- 1-0 0,,1 +1; do
+    check "CPU list '$list' rejected" "$(./bin/http_server --port 8084 --cpus "$list" 2>&1)" "Invalid CPU list"
+done
+if command -v taskset > /dev/null && command -v python3 > /dev/null; then
+    read -r CPU_A CPU_B <<< "$(python3 -c 'import os; print(*sorted(os.sched_getaffinity(0))[:2])')"
+fi
+if [ -n "$CPU_B" ]; then
+    # Only CPU_A is allowed, so CPU_B must be dropped for every thread, workers included
+    taskset -c "$CPU_A" ./bin/http_server --port 8084 --cpus "$CPU_A,$CPU_B" > cpus.log 2>&1 &
+    CPUS_PID=$!
+    sleep 1
+    response=$(cat /proc/$CPUS_PID/task/*/status | grep Cpus_allowed_list | sort -u)
+    check "Unavailable CPU skipped" "$(cat cpus.log)" "CPU $CPU_B is not available"
+    check "All threads kept on the allowed CPU" "$response" "$(printf 'Cpus_allowed_list:\t%s' "$CPU_A")"
+    check "No thread on the unavailable CPU" "$(echo "$response" | wc -l)" "1"
+    kill $CPUS_PID 2>/dev/null
+    wait $CPUS_PID 2>/dev/null
+    rm -f cpus.log
+else
+    echo "   Pinning skipped: needs taskset, python3 and two usable CPUs"
+fi
+echo
+
+echo "🔍 Testing: Graceful drain"
+./bin/http_server --port 8083 > drain.log 2>&1 &
+DRAIN_PID=$!
+sleep 1
+# Half a request body is in flight when the server is told to stop
+exec 4<>/dev/tcp/127.0.0.1/8083
+printf 'POST /echo HTTP/1.1\r\nHost: x\r\nContent-Length: 10\r\n\r\nhello' >&4
+sleep 0.3
+kill -TERM $DRAIN_PID
+sleep 0.5
+check "Stopping server waits for the in-flight request" "$(kill -0 $DRAIN_PID 2>&1 && echo alive)" "alive"
+check "Stopping server accepts no new connections" "$(curl -s -m 2 -o /dev/null -w '%{http_code}' "http://localhost:8083/health")" "000"
+printf 'world' >&4
+response=$(cat <&4)
+exec 4<&-
+check "In-flight request completed" "$response" '"body":"helloworld"'
+wait $DRAIN_PID
+check "Server exits once drained" "exit=$?." "exit=0."
+rm -f drain.log
+echo
+
+echo "🔍 Testing: Listener handoff"
+HANDOFF_SOCK="$UPLOAD_DIR/handoff.sock"
+./bin/http_server --port 8082 --handoff "$HANDOFF_SOCK" > handoff1.log 2>&1 &
+OLD_PID=$!
+sleep 1
+if command -v python3 > /dev/null; then
+    # A successor that takes the listener and exits without confirming startup
+    python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+msg, fds, flags, addr = socket.recv_fds(s, 1, 16)
+print("received %d listener(s)" % len(fds))
+' "$HANDOFF_SOCK" > /dev/null
+    sleep 0.5
+    check "Unconfirmed handoff: old server keeps running" "$(kill -0 $OLD_PID 2>&1 && echo alive)" "alive"
+    check "Unconfirmed handoff: old server still serving" "$(curl -s "http://localhost:8082/health")" '"status":"healthy"'
+fi
+./bin/http_server --port 8082 --handoff "$HANDOFF_SOCK" > handoff2.log 2>&1 &
+NEW_PID=$!
+for i in $(seq 50); do
+    kill -0 $OLD_PID 2>/dev/null || break
+    sleep 0.1
+done
+check "Confirmed handoff: old server exits" "$(kill -0 $OLD_PID 2>&1 || echo exited)" "exited"
+check "Confirmed handoff: old server drained" "$(cat handoff1.log)" "Listeners handed off to new server"
+check "Confirmed handoff: new server took the listener" "$(cat handoff2.log)" "Took over 1 listening socket(s)"
+check "Confirmed handoff: new server serving" "$(curl -s "http://localhost:8082/health")" '"status":"healthy"'
+kill $OLD_PID $NEW_PID 2>/dev/null
+wait $OLD_PID $NEW_PID 2>/dev/null
+rm -f handoff1.log handoff2.log
+echo
+
 echo " Testing complete!"
 echo
 
@@ -78,12 +451,17 @@ kill $SERVER_PID 2>/dev/null
 wait $SERVER_PID 2>/dev/null
 
 echo " Server stopped"
+rm -rf "$UPLOAD_DIR"
 echo
 echo "📋 Server log (last 10 lines):"
 echo "--------------------------------"
 tail -10 server.log 2>/dev/null || echo "No log file found"
 
 echo
+if [ $FAILURES -gt 0 ]; then
+    echo "❌ $FAILURES check(s) failed"
+    exit 1
+fi
 echo "Test completed successfully!"
 echo "You can also test manually by running: ./bin/http_server"
 echo "Then visit http://localhost:8080 in your browser" 
\ No newline at end of file